@@ -0,0 +1,280 @@
+/**
+ * @file emfs-bench.cpp
+ * @brief Microbenchmarks for every major E-MFS operation.
+ * @details Each case runs its operation in batches until a batch takes at least the minimum time,
+ *          then reports ops/s, ns/op and heap allocations per op. Allocations are counted by
+ *          replacing the global operator new in this translation unit. Pass `--json` for
+ *          machine-readable output, `--filter <text>` to run only matching cases and
+ *          `--min-time-ms <n>` to change the batch target (default 200).
+ *
+ *          Build: g++ -std=c++17 -O2 -I. bench/emfs-bench.cpp -o emfs-bench -pthread
+ */
+
+#include "e-mfs.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// --- Allocation Counting ---
+// Kept out of line: once inlined into a caller, GCC pairs the free() below with its own notion of
+// operator new and reports a mismatched deallocation.
+#if defined(__GNUC__) || defined(__clang__)
+#define EMFS_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define EMFS_BENCH_NOINLINE
+#endif
+
+static std::atomic<uint64_t> gAllocations{0};
+
+EMFS_BENCH_NOINLINE void* operator new(std::size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+EMFS_BENCH_NOINLINE void* operator new[](std::size_t size) { return operator new(size); }
+EMFS_BENCH_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+EMFS_BENCH_NOINLINE void operator delete[](void* p) noexcept { std::free(p); }
+EMFS_BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+EMFS_BENCH_NOINLINE void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// --- Harness ---
+/**
+ * @struct Case
+ * @brief One benchmark. `prepare(n)` sets up state for n operations outside the timed region;
+ *        `run(n)` performs them.
+ */
+struct Case {
+    std::string name;
+    std::string params;
+    std::function<void(size_t)> prepare;
+    std::function<void(size_t)> run;
+    size_t maxOps = size_t(1) << 24; // Caps the batch for cases whose setup is expensive
+};
+
+struct Result {
+    std::string name;
+    std::string params;
+    size_t ops = 0;
+    double nsPerOp = 0;
+    double opsPerSec = 0;
+    double allocsPerOp = 0;
+};
+
+Result measure(const Case& c, double minSeconds) {
+    size_t n = 1;
+    for (;;) {
+        if (c.prepare) c.prepare(n);
+        const uint64_t allocsBefore = gAllocations.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        c.run(n);
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const uint64_t allocs = gAllocations.load(std::memory_order_relaxed) - allocsBefore;
+        if (seconds >= minSeconds || n >= c.maxOps) {
+            Result r{c.name, c.params, n};
+            r.nsPerOp = seconds * 1e9 / static_cast<double>(n);
+            r.opsPerSec = seconds > 0 ? static_cast<double>(n) / seconds : 0;
+            r.allocsPerOp = static_cast<double>(allocs) / static_cast<double>(n);
+            return r;
+        }
+        // Aim 20% past the target so the next batch is usually the last.
+        const double scale = seconds > 0 ? minSeconds * 1.2 / seconds : 100.0;
+        n = std::min(c.maxOps, std::max(n + 1, static_cast<size_t>(static_cast<double>(n) * std::min(scale, 100.0))));
+    }
+}
+
+std::string deepPath(size_t depth, size_t tag) {
+    std::string path = "/m" + std::to_string(tag);
+    for (size_t d = 1; d < depth; ++d) path += "/d";
+    return path;
+}
+
+// Builds a tree with `fanOut` directories per level, `depth` levels and `filesPerDir` small files
+// in every directory.
+void buildTree(e_mfs::FileSystem& fs, const std::string& path, size_t fanOut, size_t depth, size_t filesPerDir) {
+    fs.mkdir(path);
+    for (size_t f = 0; f < filesPerDir; ++f) fs.writeFile(path + "/f" + std::to_string(f), "0123456789abcdef");
+    if (depth == 0) return;
+    for (size_t d = 0; d < fanOut; ++d) buildTree(fs, path + "/d" + std::to_string(d), fanOut, depth - 1, filesPerDir);
+}
+
+// --- Cases ---
+std::vector<Case> makeCases() {
+    using e_mfs::FileSystem;
+    std::vector<Case> cases;
+    auto fs = std::make_shared<std::unique_ptr<FileSystem>>();
+    auto fresh = [fs] { *fs = std::make_unique<FileSystem>(); };
+    // Paths for the batch, built in prepare so the timed loop does not measure string building.
+    auto paths = std::make_shared<std::vector<std::string>>();
+    auto numbered = [paths](size_t n, const std::function<std::string(size_t)>& make) {
+        paths->clear();
+        for (size_t i = 0; i < n; ++i) paths->push_back(make(i));
+    };
+
+    for (size_t depth : {1, 2, 4, 8, 16, 32, 64}) {
+        cases.push_back({"mkdir_p", "depth=" + std::to_string(depth),
+                         [fresh, numbered, depth](size_t n) {
+                             fresh();
+                             numbered(n, [depth](size_t i) { return deepPath(depth, i); });
+                         },
+                         [fs, paths](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->mkdir((*paths)[i]);
+                         }, size_t(1) << 20});
+    }
+
+    for (size_t size : {0, 64, 4096, 65536, 1 << 20}) {
+        const std::string params = "bytes=" + std::to_string(size);
+        auto payload = std::make_shared<std::string>(size, 'x');
+        cases.push_back({"writeFile", params, [fresh](size_t) { fresh(); },
+                         [fs, payload](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->writeFile("/file", *payload);
+                         }});
+        cases.push_back({"append", params,
+                         [fs, fresh](size_t) {
+                             fresh();
+                             (*fs)->touch("/file");
+                         },
+                         [fs, payload](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->append("/file", *payload);
+                         }, size < 4096 ? size_t(1) << 22 : (size_t(256) << 20) / size});
+        cases.push_back({"cat", params,
+                         [fs, fresh, payload](size_t) {
+                             fresh();
+                             (*fs)->writeFile("/file", *payload);
+                         },
+                         [fs](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->cat("/file");
+                         }});
+    }
+
+    for (size_t width : {16, 1024, 65536}) {
+        cases.push_back({"ls", "entries=" + std::to_string(width),
+                         [fs, fresh, width](size_t) {
+                             if (*fs && (*fs)->exists("/wide") && (*fs)->stat("/wide").childCount == width) return;
+                             fresh();
+                             (*fs)->mkdir("/wide");
+                             for (size_t i = 0; i < width; ++i) (*fs)->touch("/wide/entry" + std::to_string(i));
+                         },
+                         [fs](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->ls("/wide");
+                         }});
+    }
+
+    for (bool hit : {true, false}) {
+        cases.push_back({"exists", hit ? "hit,depth=8" : "miss,depth=8",
+                         [fs, fresh](size_t) {
+                             fresh();
+                             (*fs)->mkdir(deepPath(8, 0));
+                         },
+                         [fs, hit, path = hit ? deepPath(8, 0) : deepPath(8, 0) + "/missing"](size_t n) {
+                             size_t found = 0;
+                             for (size_t i = 0; i < n; ++i) found += (*fs)->exists(path);
+                             if (found != (hit ? n : 0)) std::abort();
+                         }});
+    }
+
+    // Trees of 10^4 and 10^5 files: fan-out 10, depth 3 or 4, ten files per directory.
+    for (size_t depth : {3, 4}) {
+        const std::string params = "files=" + std::to_string(depth == 3 ? 11110 : 111110);
+        const size_t maxCopies = depth == 3 ? 64 : 4; // Every copy is kept until the batch ends
+        auto build = [fs, fresh, depth] {
+            fresh();
+            buildTree(**fs, "/tree", 10, depth, 10);
+        };
+        auto copies = [numbered](size_t n) { numbered(n, [](size_t i) { return "/copy" + std::to_string(i); }); };
+        cases.push_back({"cp_r", params,
+                         [build, copies](size_t n) {
+                             build();
+                             copies(n);
+                         },
+                         [fs, paths](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->cp("/tree", (*paths)[i]);
+                         }, maxCopies});
+        cases.push_back({"mv", params, [build](size_t) { build(); },
+                         [fs](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->mv(i % 2 ? "/moved" : "/tree", i % 2 ? "/tree" : "/moved");
+                         }});
+        cases.push_back({"rm_r", params,
+                         [fs, build, copies, paths](size_t n) {
+                             build();
+                             copies(n);
+                             for (size_t i = 0; i < n; ++i) (*fs)->cp("/tree", (*paths)[i]);
+                         },
+                         [fs, paths](size_t n) {
+                             for (size_t i = 0; i < n; ++i) (*fs)->rm((*paths)[i], true);
+                         }, maxCopies});
+        cases.push_back({"size", params, [build](size_t) { build(); },
+                         [fs](size_t n) {
+                             size_t total = 0;
+                             for (size_t i = 0; i < n; ++i) total += (*fs)->size("/tree");
+                             if (total == 0) std::abort();
+                         }});
+    }
+    return cases;
+}
+
+std::string jsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool json = false;
+    std::string filter;
+    double minSeconds = 0.2;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time-ms" && i + 1 < argc) {
+            minSeconds = std::atof(argv[++i]) / 1000.0;
+        } else {
+            std::cerr << "usage: emfs-bench [--json] [--filter <text>] [--min-time-ms <n>]\n";
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Case& c : makeCases()) {
+        if (!filter.empty() && (c.name + " " + c.params).find(filter) == std::string::npos) continue;
+        results.push_back(measure(c, minSeconds));
+        const Result& r = results.back();
+        if (!json) {
+            std::printf("%-10s %-18s %14.0f ops/s %12.1f ns/op %10.2f allocs/op\n", r.name.c_str(), r.params.c_str(),
+                        r.opsPerSec, r.nsPerOp, r.allocsPerOp);
+            std::fflush(stdout);
+        }
+    }
+
+    if (json) {
+        std::printf("{\n  \"benchmark\": \"emfs-bench\",\n  \"min_time_ms\": %.0f,\n  \"results\": [\n", minSeconds * 1000);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            std::printf("    {\"name\": \"%s\", \"params\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.2f, "
+                        "\"ops_per_sec\": %.2f, \"allocs_per_op\": %.3f}%s\n",
+                        jsonEscape(r.name).c_str(), jsonEscape(r.params).c_str(), r.ops, r.nsPerOp, r.opsPerSec,
+                        r.allocsPerOp, i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    }
+    return 0;
+}
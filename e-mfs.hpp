@@ -12,21 +12,50 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio> // For std::remove
 #include <cstdlib> // For std::system
 #include <filesystem> // For std::filesystem::temp_directory_path
+#include <functional>
 #include <fstream> // <--- FIX: Added for std::ofstream
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
+#include <map>
 #include <numeric>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <cstring> // For std::memchr, std::memcmp
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define EMFS_X86_SIMD 1
+#include <immintrin.h>
+#endif
 
 #if defined(__linux__) || defined(__APPLE__) || defined(__MACH__)
 #include <sys/stat.h> // For chmod
+#include <unistd.h>   // For read/write in replication
+#include <cerrno>
+#define EMFS_POSIX 1
 #endif
 
 namespace e_mfs {
@@ -42,25 +71,538 @@ public:
         : std::runtime_error(message) {}
 };
 
+// --- Checksums ---
+/**
+ * @enum ChecksumAlgorithm
+ * @brief Algorithms supported by FileSystem::checksum.
+ */
+enum class ChecksumAlgorithm {
+    CRC32C, // Castagnoli CRC, SSE4.2-accelerated when available (32-bit result)
+    XXH64   // xxHash64, fast non-cryptographic 64-bit hash
+};
+
+namespace detail {
+
+inline uint32_t crc32cSoftware(uint32_t state, const char* data, size_t n) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    for (size_t i = 0; i < n; ++i) {
+        state = table[(state ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (state >> 8);
+    }
+    return state;
+}
+
+#if defined(EMFS_X86_SIMD) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t crc32cHardware(uint32_t state, const char* data, size_t n) {
+    uint64_t wide = state;
+    for (; n >= 8; data += 8, n -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+    }
+    state = static_cast<uint32_t>(wide);
+    for (; n > 0; ++data, --n) state = _mm_crc32_u8(state, static_cast<unsigned char>(*data));
+    return state;
+}
+#endif
+
+/**
+ * @brief Extends a finished CRC32C value with more data (pass 0 to start a new checksum).
+ */
+inline uint32_t crc32c(uint32_t crc, const char* data, size_t n) {
+    using CrcFn = uint32_t (*)(uint32_t, const char*, size_t);
+#if defined(EMFS_X86_SIMD) && defined(__x86_64__)
+    static const CrcFn impl = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") ? CrcFn(&crc32cHardware) : CrcFn(&crc32cSoftware);
+    }();
+#else
+    static const CrcFn impl = &crc32cSoftware;
+#endif
+    return ~impl(~crc, data, n);
+}
+
+/**
+ * @class Xxh64State
+ * @brief Streaming xxHash64, so appended data can be folded into an existing hash.
+ */
+class Xxh64State {
+public:
+    explicit Xxh64State(uint64_t seed = 0)
+        : v_{seed + P1 + P2, seed + P2, seed, seed - P1}, seed_(seed) {}
+
+    void update(const char* data, size_t n) {
+        if (n == 0) return; // `data` may be null for empty content
+        total_ += n;
+        if (bufferSize_ + n < 32) {
+            std::memcpy(buffer_ + bufferSize_, data, n);
+            bufferSize_ += n;
+            return;
+        }
+        if (bufferSize_) {
+            const size_t fill = 32 - bufferSize_;
+            std::memcpy(buffer_ + bufferSize_, data, fill);
+            consumeStripe(buffer_);
+            data += fill;
+            n -= fill;
+            bufferSize_ = 0;
+        }
+        for (; n >= 32; data += 32, n -= 32) consumeStripe(data);
+        std::memcpy(buffer_, data, n);
+        bufferSize_ = n;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (uint64_t v : v_) h = (h ^ round(0, v)) * P1 + P4;
+        } else {
+            h = seed_ + P5;
+        }
+        h += total_;
+        const char* p = buffer_;
+        size_t n = bufferSize_;
+        for (; n >= 8; p += 8, n -= 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+        if (n >= 4) {
+            h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+            p += 4;
+            n -= 4;
+        }
+        for (; n > 0; ++p, --n) h = rotl(h ^ (static_cast<unsigned char>(*p) * P5), 11) * P1;
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; }
+    static uint64_t read64(const char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+    static uint64_t read32(const char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+    void consumeStripe(const char* p) {
+        for (int i = 0; i < 4; ++i) v_[i] = round(v_[i], read64(p + 8 * i));
+    }
+
+    uint64_t v_[4];
+    uint64_t seed_;
+    uint64_t total_ = 0;
+    char buffer_[32];
+    size_t bufferSize_ = 0;
+};
+
+/**
+ * @brief One-shot xxHash64.
+ */
+inline uint64_t xxh64(const char* data, size_t n, uint64_t seed = 0) {
+    Xxh64State state(seed);
+    state.update(data, n);
+    return state.digest();
+}
+
+/**
+ * @struct ChecksumCache
+ * @brief Checksums cached on a FileNode; both algorithms can be extended in place on append.
+ */
+struct ChecksumCache {
+    bool hasCrc32c = false;
+    bool hasXxh64 = false;
+    uint32_t crc32c = 0;
+    Xxh64State xxh64;
+};
+
+} // namespace detail
+
+// --- Binary Encoding ---
+namespace detail {
+
+/**
+ * @class BinaryWriter
+ * @brief Appends little-endian integers, LEB128 varints and length-prefixed bytes to a buffer.
+ */
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::string& out) : out_(out) {}
+
+    void u8(uint8_t v) { out_.push_back(static_cast<char>(v)); }
+    void u64(uint64_t v) {
+        for (int i = 0; i < 8; ++i) out_.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+    void varint(uint64_t v) {
+        for (; v >= 0x80; v >>= 7) out_.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        out_.push_back(static_cast<char>(v));
+    }
+    void bytes(const char* data, size_t n) {
+        varint(n);
+        out_.append(data, n);
+    }
+    void string(std::string_view v) { bytes(v.data(), v.size()); }
+
+private:
+    std::string& out_;
+};
+
+/**
+ * @class BinaryReader
+ * @brief Reads what BinaryWriter produced; throws FileSystemException on truncated or malformed input.
+ */
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view in) : in_(in) {}
+
+    bool atEnd() const { return pos_ == in_.size(); }
+    size_t remaining() const { return in_.size() - pos_; }
+    uint8_t u8() {
+        need(1);
+        return static_cast<uint8_t>(in_[pos_++]);
+    }
+    uint64_t u64() {
+        need(8);
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= uint64_t(static_cast<uint8_t>(in_[pos_++])) << (8 * i);
+        return v;
+    }
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const uint8_t byte = u8();
+            v |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return v;
+        }
+        throw FileSystemException("Malformed varint in binary stream.");
+    }
+    std::string_view bytes() {
+        const uint64_t n = varint();
+        need(n);
+        std::string_view v = in_.substr(pos_, n);
+        pos_ += n;
+        return v;
+    }
+    std::string string() { return std::string(bytes()); }
+    /// An element count, for elements of at least one byte each: a count the remaining input cannot
+    /// hold is rejected before anything is sized by it.
+    uint64_t count() {
+        const uint64_t n = varint();
+        need(n);
+        return n;
+    }
+
+private:
+    void need(uint64_t n) const {
+        if (in_.size() - pos_ < n) throw FileSystemException("Unexpected end of binary stream.");
+    }
+
+    std::string_view in_;
+    size_t pos_ = 0;
+};
+
+/**
+ * @brief Reads exactly `length` bytes into `out`, growing it as data arrives so that a corrupt length
+ *        fails as truncated input instead of allocating the claimed size up front.
+ */
+inline void readExactly(std::istream& in, uint64_t length, std::string& out, const char* truncated) {
+    constexpr uint64_t kStep = uint64_t(1) << 20;
+    out.clear();
+    while (out.size() < length) {
+        const size_t at = out.size();
+        const size_t n = static_cast<size_t>(std::min(kStep, length - at));
+        out.resize(at + n);
+        if (!in.read(out.data() + at, static_cast<std::streamsize>(n))) throw FileSystemException(truncated);
+    }
+}
+
+inline std::string readExactly(std::istream& in, uint64_t length, const char* truncated) {
+    std::string out;
+    readExactly(in, length, out, truncated);
+    return out;
+}
+
+/**
+ * @brief Compresses a buffer with a small LZ77 scheme (hash-chained 4-byte matches).
+ * @details The stream is a sequence of (literal length, literals, match length, match offset) varint
+ *          records terminated by a zero match length. Fast and dependency-free rather than tight.
+ */
+inline std::string lzCompress(std::string_view in) {
+    std::string out;
+    BinaryWriter writer(out);
+    const size_t n = in.size();
+    std::vector<uint32_t> table(size_t(1) << 14, UINT32_MAX);
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + 4 <= n && n < UINT32_MAX) {
+        uint32_t word;
+        std::memcpy(&word, in.data() + i, 4);
+        const uint32_t slot = (word * 2654435761u) >> 18;
+        const uint32_t candidate = table[slot];
+        table[slot] = static_cast<uint32_t>(i);
+        if (candidate == UINT32_MAX || std::memcmp(in.data() + candidate, in.data() + i, 4) != 0) {
+            ++i;
+            continue;
+        }
+        size_t length = 4;
+        while (i + length < n && in[candidate + length] == in[i + length]) ++length;
+        writer.varint(i - anchor);
+        out.append(in.data() + anchor, i - anchor);
+        writer.varint(length);
+        writer.varint(i - candidate);
+        i += length;
+        anchor = i;
+    }
+    writer.varint(n - anchor);
+    out.append(in.data() + anchor, n - anchor);
+    writer.varint(0);
+    return out;
+}
+
+/**
+ * @brief Reverses lzCompress; `rawSize` is the expected output size, which is reserved up front, so
+ *        callers reading it from untrusted input must bound it first.
+ */
+inline std::string lzDecompress(std::string_view in, size_t rawSize) {
+    std::string out;
+    out.reserve(rawSize);
+    BinaryReader reader(in);
+    for (;;) {
+        const uint64_t literals = reader.varint();
+        if (literals > rawSize - out.size()) throw FileSystemException("Corrupt compressed stream.");
+        for (uint64_t k = 0; k < literals; ++k) out.push_back(static_cast<char>(reader.u8()));
+        const uint64_t length = reader.varint();
+        if (length == 0) break;
+        const uint64_t offset = reader.varint();
+        if (offset == 0 || offset > out.size() || length > rawSize - out.size()) {
+            throw FileSystemException("Corrupt compressed stream.");
+        }
+        const size_t from = out.size() - offset;
+        for (uint64_t k = 0; k < length; ++k) out.push_back(out[from + k]); // Overlap-safe
+    }
+    if (out.size() != rawSize) throw FileSystemException("Corrupt compressed stream.");
+    return out;
+}
+
+} // namespace detail
+
+// --- Timestamps ---
+namespace detail {
+
+/// Wall-clock time in nanoseconds since the Unix epoch, the unit of every node timestamp.
+inline int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/// Process-wide change counter: every node change takes a fresh value, so equal versions mean "unchanged".
+inline uint64_t nextVersion() {
+    static std::atomic<uint64_t> clock{0};
+    return clock.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+inline int64_t toNanos(std::chrono::system_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+} // namespace detail
+
 // --- Node Type Enumeration ---
-enum class NodeType { File, Directory };
+enum class NodeType { File, Directory, Symlink };
+
+// --- Node Metadata ---
+/**
+ * @enum AtimePolicy
+ * @brief When reads refresh a node's access time.
+ * @details Relaxed behaves like Linux `relatime`: atime is only written when it is older than mtime or
+ *          ctime, or more than a day old, so repeated reads add no write traffic.
+ */
+enum class AtimePolicy : uint8_t { None, Relaxed, Strict };
+
+constexpr uint16_t kDefaultFileMode = 0644;
+constexpr uint16_t kDefaultDirectoryMode = 0755;
+constexpr uint16_t kDefaultSymlinkMode = 0777;
+
+/**
+ * @struct NodeMetadata
+ * @brief Timestamps, version, permission bits and ownership of a node, packed into 48 bytes.
+ * @details Timestamps are nanoseconds since the Unix epoch. atime is a relaxed atomic so that const
+ *          reads can refresh it without a lock.
+ */
+struct NodeMetadata {
+    int64_t mtime;                         // Content (files) or entry list (directories) last changed
+    int64_t ctime;                         // Content or metadata last changed
+    mutable std::atomic<int64_t> atime;    // Last read, subject to the AtimePolicy
+    uint64_t version;                      // detail::nextVersion() at the last change to content or metadata
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint16_t mode;                         // Permission bits only (07777)
+
+    explicit NodeMetadata(uint16_t mode, int64_t now = detail::nowNanos())
+        : mtime(now), ctime(now), atime(now), version(detail::nextVersion()), mode(mode) {}
+    NodeMetadata(const NodeMetadata& other)
+        : mtime(other.mtime), ctime(other.ctime), atime(other.atime.load(std::memory_order_relaxed)),
+          version(other.version), uid(other.uid), gid(other.gid), mode(other.mode) {}
+    NodeMetadata& operator=(const NodeMetadata& other) {
+        mtime = other.mtime;
+        ctime = other.ctime;
+        atime.store(other.atime.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        version = other.version;
+        uid = other.uid;
+        gid = other.gid;
+        mode = other.mode;
+        return *this;
+    }
+
+    void modified(int64_t now) {
+        mtime = now;
+        changed(now);
+    }
+
+    void changed(int64_t now) {
+        ctime = now;
+        version = detail::nextVersion();
+    }
+};
+
+// --- Extended Attributes ---
+/**
+ * @brief How setxattr treats an existing attribute, mirroring XATTR_CREATE and XATTR_REPLACE.
+ */
+enum class XattrMode : uint8_t { Upsert, Create, Replace };
+
+constexpr size_t kMaxXattrNameLength = 255;
+constexpr size_t kMaxXattrValueSize = size_t(64) << 10;
+
+namespace detail {
+
+/**
+ * @class XattrMap
+ * @brief The extended attributes of one node.
+ * @details Up to kInlineCapacity entries live in a flat vector searched linearly, which beats hashing
+ *          for the handful of tags a node usually carries. Larger sets spill into a hash map for good.
+ */
+class XattrMap {
+public:
+    static constexpr size_t kInlineCapacity = 8;
+
+    XattrMap() = default;
+    XattrMap(const XattrMap& other)
+        : small_(other.small_), large_(other.large_ ? std::make_unique<Large>(*other.large_) : nullptr) {}
+    XattrMap& operator=(const XattrMap&) = delete;
+
+    size_t size() const { return large_ ? large_->size() : small_.size(); }
+    bool empty() const { return size() == 0; }
+
+    const std::string* find(std::string_view name) const {
+        if (large_) {
+            const auto it = large_->find(_key(name));
+            return it == large_->end() ? nullptr : &it->second;
+        }
+        for (const auto& [key, value] : small_) {
+            if (key == name) return &value;
+        }
+        return nullptr;
+    }
+
+    /// Inserts or overwrites `name`; returns false if it already existed.
+    bool set(std::string_view name, std::string_view value) {
+        if (large_) {
+            const auto [it, inserted] = large_->try_emplace(std::string(name));
+            it->second.assign(value);
+            return inserted;
+        }
+        for (auto& [key, existing] : small_) {
+            if (key == name) {
+                existing.assign(value);
+                return false;
+            }
+        }
+        if (small_.size() < kInlineCapacity) {
+            small_.emplace_back(std::string(name), std::string(value));
+            return true;
+        }
+        large_ = std::make_unique<Large>();
+        large_->reserve(kInlineCapacity * 2);
+        for (auto& [key, existing] : small_) large_->emplace(std::move(key), std::move(existing));
+        small_.clear();
+        small_.shrink_to_fit();
+        large_->emplace(std::string(name), std::string(value));
+        return true;
+    }
+
+    bool erase(std::string_view name) {
+        if (large_) return large_->erase(_key(name)) > 0;
+        for (auto it = small_.begin(); it != small_.end(); ++it) {
+            if (it->first == name) {
+                small_.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        if (large_) {
+            for (const auto& [key, value] : *large_) fn(key, value);
+        } else {
+            for (const auto& [key, value] : small_) fn(key, value);
+        }
+    }
+
+private:
+    using Large = std::unordered_map<std::string, std::string>;
+
+    // std::unordered_map has no heterogeneous lookup before C++20; reuse one buffer per thread.
+    static const std::string& _key(std::string_view name) {
+        thread_local std::string key;
+        key.assign(name);
+        return key;
+    }
+
+    std::vector<std::pair<std::string, std::string>> small_;
+    std::unique_ptr<Large> large_;
+};
+
+} // namespace detail
 
 // --- Forward Declarations ---
 struct FSNode;
 struct FileNode;
 struct DirectoryNode;
+struct SymlinkNode;
 
 // --- Base Node Structure ---
 /**
  * @struct FSNode
- * @brief Abstract base class for file system nodes (files or directories).
+ * @brief Abstract base class for file system nodes (files, directories or symbolic links).
  */
-struct FSNode {
+struct FSNode : public std::enable_shared_from_this<FSNode> {
     std::string name;                     // Name of the node
     std::weak_ptr<DirectoryNode> parent;  // Weak pointer to parent directory to avoid circular references
+    mutable uint64_t merkleHash = 0;      // Last computed Merkle hash; valid only while !merkleDirty
+    mutable bool merkleDirty = true;      // Set on change and propagated up the parent chain
+    NodeMetadata meta;                    // Timestamps, mode and ownership
+    std::unique_ptr<detail::XattrMap> xattrs; // Extended attributes; null until the first is set
+    int64_t expiresAt = 0;                // Nanoseconds since the Unix epoch; 0 if the node has no TTL
+    mutable std::atomic<uint64_t> heat{0}; // Decayed read estimate (low 40 bits) and its decay epoch (high 24)
 
-    FSNode(std::string name, std::shared_ptr<DirectoryNode> parent)
-        : name(std::move(name)), parent(std::move(parent)) {}
+    FSNode(std::string name, std::shared_ptr<DirectoryNode> parent, uint16_t mode)
+        : name(std::move(name)), parent(std::move(parent)), meta(mode) {}
     virtual ~FSNode() = default;
     virtual NodeType getType() const = 0;
     virtual size_t size() const = 0; // Get the size in bytes
@@ -71,25 +613,27 @@ struct FSNode {
  * @struct DirectoryNode
  * @brief Represents a directory in the memory file system.
  */
-struct DirectoryNode final : public FSNode, public std::enable_shared_from_this<DirectoryNode> {
+struct DirectoryNode final : public FSNode {
     std::unordered_map<std::string, std::shared_ptr<FSNode>> children; // Child nodes
 
+    // Merkle state: merkleSum is the (order-independent) sum of every contributed child entry.
+    // merklePending maps child names whose entry must be refreshed to the hash they last contributed
+    // (nullopt if they never did); merkleRebuild forces a full pass, e.g. for fresh directories.
+    mutable uint64_t merkleSum = 0;
+    mutable bool merkleRebuild = true;
+    mutable std::unique_ptr<std::unordered_map<std::string, std::optional<uint64_t>>> merklePending;
+    size_t totalSize = 0; // Bytes of every file below, kept current by FileSystem on each change
+
     DirectoryNode(const std::string& name, std::shared_ptr<DirectoryNode> parent)
-        : FSNode(name, std::move(parent)) {}
+        : FSNode(name, std::move(parent), kDefaultDirectoryMode) {}
 
     NodeType getType() const override { return NodeType::Directory; }
 
     /**
-     * @brief Recursively calculates the total size of all files within this directory.
+     * @brief Returns the total size of all files within this directory, in O(1).
      * @return Total size in bytes.
      */
-    size_t size() const override {
-        size_t total_size = 0;
-        for (const auto& [name, child] : children) {
-            total_size += child->size();
-        }
-        return total_size;
-    }
+    size_t size() const override { return totalSize; }
 };
 
 // --- File Node ---
@@ -98,10 +642,19 @@ struct DirectoryNode final : public FSNode, public std::enable_shared_from_this<
  * @brief Represents a file in the memory file system.
  */
 struct FileNode final : public FSNode {
+    /// A hard link beyond the primary one held in FSNode::parent and FSNode::name.
+    struct Link {
+        std::weak_ptr<DirectoryNode> parent;
+        std::string name;
+    };
+
     std::vector<char> content; // File content as binary data
+    mutable std::unique_ptr<detail::ChecksumCache> checksums; // Lazily filled by FileSystem::checksum
+    uint32_t nlink = 0;             // Directory entries referring to this file
+    std::vector<Link> extraLinks;   // Every entry but the primary one
 
     FileNode(const std::string& name, std::shared_ptr<DirectoryNode> parent)
-        : FSNode(name, std::move(parent)) {}
+        : FSNode(name, std::move(parent), kDefaultFileMode) {}
     NodeType getType() const override { return NodeType::File; }
 
     /**
@@ -111,286 +664,4922 @@ struct FileNode final : public FSNode {
     size_t size() const override { return content.size(); }
 };
 
-// --- Main File System Class ---
+// --- Symbolic Link Node ---
 /**
- * @class FileSystem
- * @brief Provides a shell-like API for managing an in-memory file system.
+ * @struct SymlinkNode
+ * @brief A symbolic link: a path, absolute or relative to the link's directory, resolved on access.
  */
-class FileSystem {
+struct SymlinkNode final : public FSNode {
+    std::string target;
+
+    // Last successful resolution, valid while `generation` equals the FileSystem's tree generation.
+    // Atomics let concurrent const lookups fill it; `generation` is published last.
+    struct Resolution {
+        std::atomic<const FSNode*> node{nullptr};
+        std::atomic<int> hops{0}; // Links followed inside the target path
+        std::atomic<uint64_t> generation{0};
+    };
+    mutable Resolution resolution;
+
+    SymlinkNode(const std::string& name, std::shared_ptr<DirectoryNode> parent, std::string target)
+        : FSNode(name, std::move(parent), kDefaultSymlinkMode), target(std::move(target)) {}
+    NodeType getType() const override { return NodeType::Symlink; }
+
+    /**
+     * @brief Returns the length of the target path, like lstat's st_size.
+     */
+    size_t size() const override { return target.size(); }
+};
+
+// --- Node Status ---
+/**
+ * @struct NodeStat
+ * @brief Everything FileSystem::stat reports about a node, gathered with a single path lookup.
+ */
+struct NodeStat {
+    NodeType type = NodeType::File;
+    size_t size = 0;        // File length, total bytes below a directory, or a symlink's target length
+    size_t childCount = 0;  // Directory entries; 0 for files
+    uint32_t nlink = 1;     // Hard links to a file; 1 for directories
+    uint16_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    int64_t mtime = 0;      // Nanoseconds since the Unix epoch
+    int64_t ctime = 0;
+    int64_t atime = 0;
+    uint64_t version = 0;   // Changes whenever content or metadata changes
+    int64_t expiresAt = 0;  // When a TTL removes the node; 0 if none
+};
+
+/**
+ * @enum LinkAccounting
+ * @brief How directory sizes count a file with several hard links.
+ * @details CountOnce adds its bytes only under the directory of its primary link (like `du`);
+ *          CountEach adds them under every directory that links it (like `du -l`).
+ */
+enum class LinkAccounting : uint8_t { CountOnce, CountEach };
+
+/**
+ * @enum ListSort
+ * @brief Ordering of FileSystem::lsDetailed; Size and Mtime break ties by name.
+ */
+enum class ListSort : uint8_t { Name, Size, Mtime };
+
+/**
+ * @struct ListOptions
+ * @brief Sorting and pagination for FileSystem::lsDetailed.
+ */
+struct ListOptions {
+    ListSort sortBy = ListSort::Name;
+    bool reverse = false;
+    size_t offset = 0;        // Entries to skip after sorting
+    size_t limit = SIZE_MAX;  // Maximum entries returned
+};
+
+/**
+ * @struct DirEntry
+ * @brief One directory entry as returned by FileSystem::lsDetailed.
+ */
+struct DirEntry {
+    std::string name;
+    NodeStat stat;
+};
+
+// --- Consistency Checks ---
+/**
+ * @struct VerifyReport
+ * @brief Result of FileSystem::verify(): node counts and one message per violated invariant.
+ */
+struct VerifyReport {
+    size_t directories = 0;
+    size_t files = 0;
+    size_t symlinks = 0;
+    std::vector<std::string> errors; // "<path>: <problem>"
+
+    bool ok() const { return errors.empty(); }
+};
+
+// --- Access Heat ---
+/**
+ * @struct HeatOptions
+ * @brief Settings for FileSystem::enableHeatTracking.
+ */
+struct HeatOptions {
+    uint32_t sampleEvery = 16; // Reads per sampled update, rounded up to a power of two
+    std::chrono::nanoseconds halfLife = std::chrono::minutes(10); // Counts halve once per half-life
+};
+
+/**
+ * @struct HeatEntry
+ * @brief A file or directory with its estimated decayed read count; a directory's covers its subtree.
+ */
+struct HeatEntry {
+    std::string path;
+    NodeType type = NodeType::File;
+    uint64_t heat = 0;
+};
+
+/**
+ * @struct HeatReport
+ * @brief Result of FileSystem::heatReport: `hottest` in descending, `coldest` in ascending order.
+ */
+struct HeatReport {
+    std::vector<HeatEntry> hottest;
+    std::vector<HeatEntry> coldest;
+};
+
+// --- Node Handles ---
+/**
+ * @class NodeHandle
+ * @brief A node resolved once by FileSystem::open, so later calls through it skip path resolution.
+ * @details Like an open file descriptor, the handle keeps its node alive and keeps referring to it
+ *          across renames; after the node is removed, changes through the handle are no longer visible
+ *          in the tree.
+ */
+class NodeHandle {
+public:
+    NodeHandle() = default;
+
+    explicit operator bool() const { return node_ != nullptr; }
+    NodeType type() const { return node_->getType(); }
+
 private:
-    std::shared_ptr<DirectoryNode> root; // Root directory of the file system
+    friend class FileSystem;
+    explicit NodeHandle(std::shared_ptr<FSNode> node) : node_(std::move(node)) {}
 
-    // --- Helper Methods ---
-    std::shared_ptr<FSNode> _resolvePath(std::string_view path) const {
-        if (path.empty()) {
-            throw FileSystemException("Path cannot be empty.");
-        }
-        if (path == "/") return root;
+    std::shared_ptr<FSNode> node_;
+};
 
-        std::string path_str(path);
-        std::stringstream ss(path_str);
-        std::string component;
-        std::shared_ptr<DirectoryNode> current = root;
+// --- Secondary Indexes ---
+/**
+ * @struct FileQuery
+ * @brief Predicates for FileSystem::find; unset fields match every file.
+ */
+struct FileQuery {
+    std::optional<std::string> extension;  // Including the dot, e.g. ".log"; "" matches files without one
+    std::optional<size_t> minSize;         // Inclusive
+    std::optional<size_t> maxSize;         // Inclusive
+    std::optional<std::chrono::system_clock::time_point> modifiedAfter;  // Inclusive
+    std::optional<std::chrono::system_clock::time_point> modifiedBefore; // Inclusive
+};
 
-        if (ss.peek() == '/') ss.ignore();
+namespace detail {
 
-        while (std::getline(ss, component, '/')) {
-            if (component.empty() || component == ".") continue;
-            if (component == "..") {
-                if (current != root) {
-                    current = current->parent.lock();
-                }
-                continue;
-            }
-            auto it = current->children.find(component);
-            if (it == current->children.end()) {
-                throw FileSystemException("Path not found: " + path_str);
-            }
-            if (it->second->getType() != NodeType::Directory && ss.peek() != EOF) {
-                 throw FileSystemException("Path component is not a directory: " + component);
-            }
-            if (it->second->getType() == NodeType::Directory) {
-                current = std::static_pointer_cast<DirectoryNode>(it->second);
-            } else {
-                 return it->second; // Return the file if it's the last component
-            }
-        }
-        return current;
+/// Extension as std::filesystem::path::extension() defines it: ".gz" for "a.tar.gz", "" for ".bashrc".
+inline std::string_view extensionOf(std::string_view name) {
+    const size_t dot = name.find_last_of('.');
+    if (dot == std::string_view::npos || dot == 0 || name == "..") return {};
+    return name.substr(dot);
+}
+
+/**
+ * @class SecondaryIndexes
+ * @brief Opt-in file indexes kept current by FileSystem mutations: a hash by extension and
+ *        ordered sets by size and modification time.
+ */
+class SecondaryIndexes {
+public:
+    void insert(const FileNode& file) {
+        byExtension_[std::string(extensionOf(file.name))].insert(&file);
+        bySize_.emplace(file.content.size(), &file);
+        byMtime_.emplace(file.meta.mtime, &file);
     }
 
-    std::pair<std::shared_ptr<DirectoryNode>, std::string> _resolveParentAndName(std::string_view path) const {
-        if (path.empty() || path == "/") {
-            throw FileSystemException("Invalid path for child creation: " + std::string(path));
+    void erase(const FileNode& file) {
+        auto it = byExtension_.find(std::string(extensionOf(file.name)));
+        if (it != byExtension_.end()) {
+            it->second.erase(&file);
+            if (it->second.empty()) byExtension_.erase(it);
         }
-        size_t last_slash = path.find_last_of('/');
-        if (last_slash == std::string::npos) { // e.g., "file.txt"
-            throw FileSystemException("Paths must be absolute (start with '/'): " + std::string(path));
+        bySize_.erase({file.content.size(), &file});
+        byMtime_.erase({file.meta.mtime, &file});
+    }
+
+    /// Re-keys a file whose content or timestamp changed; `oldSize`/`oldMtime` are the indexed values.
+    void update(const FileNode& file, size_t oldSize, int64_t oldMtime) {
+        if (oldSize != file.content.size()) {
+            bySize_.erase({oldSize, &file});
+            bySize_.emplace(file.content.size(), &file);
         }
-        
-        std::string_view parentPath_sv = (last_slash == 0) ? "/" : path.substr(0, last_slash);
-        std::string_view childName_sv = path.substr(last_slash + 1);
-        
-        if (childName_sv.empty()) {
-            throw FileSystemException("Path cannot end with a slash for this operation: " + std::string(path));
+        if (oldMtime != file.meta.mtime) {
+            byMtime_.erase({oldMtime, &file});
+            byMtime_.emplace(file.meta.mtime, &file);
         }
+    }
 
-        auto parentNode = _resolvePath(parentPath_sv);
-        if (parentNode->getType() != NodeType::Directory) {
-            throw FileSystemException("Parent path is not a directory: " + std::string(parentPath_sv));
+    /// Re-keys a file after a rename; `oldName` is the name it was indexed under.
+    void rename(const FileNode& file, std::string_view oldName) {
+        const auto oldExt = extensionOf(oldName);
+        const auto newExt = extensionOf(file.name);
+        if (oldExt == newExt) return;
+        auto it = byExtension_.find(std::string(oldExt));
+        if (it != byExtension_.end()) {
+            it->second.erase(&file);
+            if (it->second.empty()) byExtension_.erase(it);
         }
-        return {std::static_pointer_cast<DirectoryNode>(parentNode), std::string(childName_sv)};
+        byExtension_[std::string(newExt)].insert(&file);
     }
-    
-    // Improved helper to handle destinations like `cp file /dir/`
-    std::pair<std::shared_ptr<DirectoryNode>, std::string> _resolveDestination(std::string_view dest_path, const std::string& source_name) const {
-        try {
-            auto dest_node = _resolvePath(dest_path);
-            if (dest_node->getType() == NodeType::Directory) {
-                // Destination is an existing directory, so the final name is the source name.
-                auto dest_dir = std::static_pointer_cast<DirectoryNode>(dest_node);
-                if (dest_dir->children.count(source_name)) {
-                     throw FileSystemException("Destination '" + std::string(dest_path) + "/" + source_name + "' already exists.");
+
+    /**
+     * @brief Returns the files matching every predicate of `query`.
+     * @details The most selective index drives the scan: the extension bucket size is known in O(1),
+     *          and each range is counted only until it exceeds the best candidate count so far. The
+     *          remaining predicates are checked on the candidate nodes directly.
+     */
+    std::vector<const FileNode*> query(const FileQuery& query) const {
+        const std::unordered_set<const FileNode*>* extSet = nullptr;
+        size_t best = SIZE_MAX;
+        if (query.extension) {
+            auto it = byExtension_.find(*query.extension);
+            if (it == byExtension_.end()) return {};
+            extSet = &it->second;
+            best = extSet->size();
+        }
+
+        const size_t minSize = query.minSize.value_or(0);
+        const size_t maxSize = query.maxSize.value_or(SIZE_MAX);
+        const int64_t after = query.modifiedAfter ? toNanos(*query.modifiedAfter) : INT64_MIN;
+        const int64_t before = query.modifiedBefore ? toNanos(*query.modifiedBefore) : INT64_MAX;
+        if (minSize > maxSize || after > before) return {};
+
+        auto sizeBegin = bySize_.lower_bound({minSize, nullptr});
+        auto sizeEnd = maxSize == SIZE_MAX ? bySize_.end() : bySize_.lower_bound({maxSize + 1, nullptr});
+        auto timeBegin = byMtime_.lower_bound({after, nullptr});
+        auto timeEnd = before == INT64_MAX ? byMtime_.end() : byMtime_.lower_bound({before + 1, nullptr});
+
+        enum class Driver { All, Extension, Size, Mtime } driver = extSet ? Driver::Extension : Driver::All;
+        if (query.minSize || query.maxSize) {
+            const size_t n = countUpTo(sizeBegin, sizeEnd, best);
+            if (n < best || driver == Driver::All) { best = n; driver = Driver::Size; }
+        }
+        if (query.modifiedAfter || query.modifiedBefore) {
+            const size_t n = countUpTo(timeBegin, timeEnd, best);
+            if (n < best || driver == Driver::All) { best = n; driver = Driver::Mtime; }
+        }
+
+        std::vector<const FileNode*> result;
+        auto consider = [&](const FileNode* file) {
+            if (extSet && driver != Driver::Extension && !extSet->count(file)) return;
+            const size_t size = file->content.size();
+            if (size < minSize || size > maxSize) return;
+            if (file->meta.mtime < after || file->meta.mtime > before) return;
+            result.push_back(file);
+        };
+        switch (driver) {
+            case Driver::Extension: for (const auto* file : *extSet) consider(file); break;
+            case Driver::Size: for (auto it = sizeBegin; it != sizeEnd; ++it) consider(it->second); break;
+            case Driver::Mtime: for (auto it = timeBegin; it != timeEnd; ++it) consider(it->second); break;
+            case Driver::All: for (const auto& entry : bySize_) consider(entry.second); break;
+        }
+        return result;
+    }
+
+    size_t fileCount() const { return bySize_.size(); }
+
+private:
+    template <typename It>
+    static size_t countUpTo(It begin, It end, size_t limit) {
+        size_t n = 0;
+        for (; begin != end && n <= limit; ++begin) ++n;
+        return n;
+    }
+
+    std::unordered_map<std::string, std::unordered_set<const FileNode*>> byExtension_;
+    std::set<std::pair<size_t, const FileNode*>> bySize_;
+    std::set<std::pair<int64_t, const FileNode*>> byMtime_;
+};
+
+} // namespace detail
+
+// --- Full-Text Index ---
+namespace detail {
+
+/**
+ * @class InvertedIndex
+ * @brief Optional full-text index: term -> compressed postings of (document, position) pairs.
+ * @details Tokens are runs of ASCII letters/digits or non-ASCII bytes, lower-cased. Each posting list is
+ *          a varint stream of (document delta, position delta) sorted by document then position; new
+ *          occurrences past its end are appended in place, others wait in a small pending buffer that
+ *          is merged once it grows beyond an eighth of the list. Removed documents are tombstoned and
+ *          dropped from lists on the next merge, so rm and rewrites cost O(1) in the postings. An append
+ *          that extends a file's final token withdraws that occurrence the same way: from the pending
+ *          buffer, by cutting the list's tail, or as a tombstone, so appends to a log stay O(1).
+ */
+class InvertedIndex {
+public:
+    /// Indexes a new file, or re-indexes one whose content was rewritten.
+    void index(const FileNode& file) {
+        remove(file);
+        const uint32_t doc = static_cast<uint32_t>(docs_.size());
+        docs_.push_back({&file, 0, 0, 0, false});
+        docIds_[&file] = doc;
+        ++liveDocs_;
+        tokenize(doc, file.content.data(), 0, file.content.size());
+    }
+
+    /// Indexes bytes appended to a file from `oldSize` onwards.
+    void append(const FileNode& file, size_t oldSize) {
+        auto it = docIds_.find(&file);
+        if (it == docIds_.end()) { index(file); return; }
+        const uint32_t doc = it->second;
+        DocInfo& info = docs_[doc];
+        size_t from = oldSize;
+        if (info.endsInToken && oldSize < file.content.size() && isTokenByte(file.content[oldSize])) {
+            // The append extends the last token: drop its old occurrence and re-tokenize from its start.
+            --info.tokenCount;
+            postings_[info.lastTerm].erase(doc, info.tokenCount, docs_);
+            from = info.lastTokenStart;
+        }
+        tokenize(doc, file.content.data(), from, file.content.size());
+    }
+
+    void remove(const FileNode& file) {
+        auto it = docIds_.find(&file);
+        if (it == docIds_.end()) return;
+        docs_[it->second].file = nullptr; // Tombstone; postings are cleaned lazily
+        docIds_.erase(it);
+        --liveDocs_;
+        if (docs_.size() > 64 && liveDocs_ < docs_.size() / 2) compactAll();
+    }
+
+    /**
+     * @brief Evaluates a query of terms joined by AND / OR (adjacent terms imply AND; AND binds tighter).
+     */
+    std::vector<const FileNode*> search(std::string_view query) const {
+        std::vector<uint32_t> result;
+        std::vector<uint32_t> group;
+        bool groupStarted = false;
+        auto closeGroup = [&] {
+            if (!groupStarted) return;
+            std::vector<uint32_t> merged;
+            std::set_union(result.begin(), result.end(), group.begin(), group.end(), std::back_inserter(merged));
+            result.swap(merged);
+            group.clear();
+            groupStarted = false;
+        };
+        size_t i = 0;
+        while (i < query.size()) {
+            while (i < query.size() && std::isspace(static_cast<unsigned char>(query[i]))) ++i;
+            size_t end = i;
+            while (end < query.size() && !std::isspace(static_cast<unsigned char>(query[end]))) ++end;
+            std::string_view word = query.substr(i, end - i);
+            i = end;
+            if (word.empty() || word == "AND") continue;
+            if (word == "OR") { closeGroup(); continue; }
+            // A query word may itself contain several tokens (e.g. "foo-bar"); all are required.
+            for (const std::string& term : tokens(word)) {
+                std::vector<uint32_t> docs = lookup(term);
+                if (!groupStarted) {
+                    group.swap(docs);
+                    groupStarted = true;
+                } else {
+                    std::vector<uint32_t> both;
+                    std::set_intersection(group.begin(), group.end(), docs.begin(), docs.end(), std::back_inserter(both));
+                    group.swap(both);
                 }
-                return {dest_dir, source_name};
+            }
+        }
+        closeGroup();
+        std::vector<const FileNode*> files;
+        files.reserve(result.size());
+        for (uint32_t doc : result) files.push_back(docs_[doc].file);
+        return files;
+    }
+
+    /// Approximate heap bytes held by the index (postings, dictionary and document table).
+    size_t memoryUsage() const {
+        size_t bytes = docs_.capacity() * sizeof(DocInfo) + postings_.capacity() * sizeof(Posting);
+        bytes += docIds_.size() * (sizeof(void*) * 2 + sizeof(uint32_t) + sizeof(void*));
+        for (const auto& [term, id] : terms_) bytes += term.capacity() + sizeof(term) + sizeof(id) + sizeof(void*) * 2;
+        for (const auto& posting : postings_) {
+            bytes += posting.encoded.capacity() +
+                     (posting.pending.capacity() + posting.dropped.capacity()) * sizeof(Occurrence);
+        }
+        return bytes;
+    }
+
+    static bool isTokenByte(char c) {
+        const auto u = static_cast<unsigned char>(c);
+        return std::isalnum(u) || u >= 0x80;
+    }
+
+private:
+    struct DocInfo {
+        const FileNode* file;    // nullptr once removed
+        uint32_t tokenCount;     // Next position to assign
+        uint32_t lastTerm;       // Term of the final token, for appends that extend it
+        size_t lastTokenStart;   // Byte offset of the final token
+        bool endsInToken;        // Content ends inside a token
+    };
+
+    struct Occurrence {
+        uint32_t doc;
+        uint32_t pos;
+        bool operator<(const Occurrence& o) const { return doc != o.doc ? doc < o.doc : pos < o.pos; }
+        bool operator==(const Occurrence& o) const { return doc == o.doc && pos == o.pos; }
+    };
+
+    struct Posting {
+        std::string encoded;          // Sorted varint (doc delta, position delta) pairs
+        uint32_t encodedCount = 0;
+        Occurrence last{0, 0};        // Final occurrence in `encoded`
+        std::vector<Occurrence> pending;
+        std::vector<Occurrence> dropped; // Occurrences still in `encoded` but erased; purged on merge
+        size_t tailOffset = 0;        // Where `last` starts in `encoded`...
+        Occurrence beforeLast{0, 0};  // ...and the occurrence before it, while tailErasable
+        bool tailErasable = false;
+
+        void add(Occurrence occ, const std::vector<DocInfo>& docs) {
+            if (pending.empty() && (encodedCount == 0 || last < occ)) {
+                beforeLast = encodedCount ? last : Occurrence{0, 0};
+                tailOffset = encoded.size();
+                tailErasable = true;
+                encodeAfter(encoded, beforeLast, occ);
+                last = occ;
+                ++encodedCount;
+                return;
+            }
+            pending.push_back(occ);
+            if (pending.size() > 64 + encodedCount / 8) compact(docs);
+        }
+
+        void erase(uint32_t doc, uint32_t pos, const std::vector<DocInfo>& docs) {
+            const Occurrence occ{doc, pos};
+            // The occurrence is usually the one added last, so search from the back.
+            auto it = std::find(pending.rbegin(), pending.rend(), occ);
+            if (it != pending.rend()) {
+                pending.erase(std::next(it).base());
+                return;
+            }
+            if (tailErasable && encodedCount && last == occ) {
+                encoded.resize(tailOffset);
+                last = beforeLast;
+                --encodedCount;
+                tailErasable = false;
+                return;
+            }
+            dropped.push_back(occ);
+            if (dropped.size() > 64 + encodedCount / 8) compact(docs);
+        }
+
+        /// Merges pending occurrences and drops erased ones and those of tombstoned documents.
+        /// `renumber`, when given, maps every live document id to its new (order-preserving) id.
+        void compact(const std::vector<DocInfo>& docs, const std::vector<uint32_t>* renumber = nullptr) {
+            std::vector<Occurrence> all = decode();
+            all.insert(all.end(), pending.begin(), pending.end());
+            std::sort(all.begin(), all.end());
+            pending.clear();
+            pending.shrink_to_fit();
+            dropped.clear();
+            dropped.shrink_to_fit();
+            encoded.clear();
+            encodedCount = 0;
+            tailErasable = false;
+            Occurrence prev{0, 0};
+            for (auto occ : all) {
+                if (!docs[occ.doc].file) continue;
+                if (renumber) occ.doc = (*renumber)[occ.doc];
+                encodeAfter(encoded, prev, occ);
+                prev = last = occ;
+                ++encodedCount;
+            }
+            encoded.shrink_to_fit();
+        }
+
+        /// The encoded occurrences, minus those erased since the last merge.
+        std::vector<Occurrence> decode() const {
+            std::vector<Occurrence> out;
+            out.reserve(encodedCount);
+            BinaryReader reader(encoded);
+            Occurrence prev{0, 0};
+            while (!reader.atEnd()) {
+                const auto docDelta = static_cast<uint32_t>(reader.varint());
+                const auto posValue = static_cast<uint32_t>(reader.varint());
+                Occurrence occ{prev.doc + docDelta, docDelta ? posValue : prev.pos + posValue};
+                out.push_back(occ);
+                prev = occ;
+            }
+            if (!dropped.empty()) {
+                std::vector<Occurrence> gone = dropped;
+                std::sort(gone.begin(), gone.end());
+                out.erase(std::remove_if(out.begin(), out.end(), [&](const Occurrence& o) {
+                    return std::binary_search(gone.begin(), gone.end(), o);
+                }), out.end());
+            }
+            return out;
+        }
+
+        static void encodeAfter(std::string& out, Occurrence prev, Occurrence occ) {
+            BinaryWriter writer(out);
+            writer.varint(occ.doc - prev.doc);
+            writer.varint(occ.doc == prev.doc ? occ.pos - prev.pos : occ.pos);
+        }
+    };
+
+    static std::vector<std::string> tokens(std::string_view text) {
+        std::vector<std::string> out;
+        for (size_t i = 0; i < text.size();) {
+            if (!isTokenByte(text[i])) { ++i; continue; }
+            std::string token;
+            for (; i < text.size() && isTokenByte(text[i]); ++i) {
+                token.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(text[i]))));
+            }
+            out.push_back(std::move(token));
+        }
+        return out;
+    }
+
+    void tokenize(uint32_t doc, const char* data, size_t from, size_t to) {
+        std::string token;
+        for (size_t i = from; i < to;) {
+            if (!isTokenByte(data[i])) { ++i; continue; }
+            const size_t start = i;
+            token.clear();
+            for (; i < to && isTokenByte(data[i]); ++i) {
+                token.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(data[i]))));
+            }
+            auto [it, inserted] = terms_.try_emplace(token, static_cast<uint32_t>(postings_.size()));
+            if (inserted) postings_.emplace_back();
+            DocInfo& info = docs_[doc];
+            postings_[it->second].add({doc, info.tokenCount++}, docs_);
+            info.lastTerm = it->second;
+            info.lastTokenStart = start;
+        }
+        docs_[doc].endsInToken = to > 0 && isTokenByte(data[to - 1]);
+    }
+
+    std::vector<uint32_t> lookup(const std::string& term) const {
+        auto it = terms_.find(term);
+        if (it == terms_.end()) return {};
+        const Posting& posting = postings_[it->second];
+        std::vector<uint32_t> docs;
+        for (const auto& occ : posting.decode()) {
+            if (docs_[occ.doc].file && (docs.empty() || docs.back() != occ.doc)) docs.push_back(occ.doc);
+        }
+        for (const auto& occ : posting.pending) {
+            if (docs_[occ.doc].file) docs.push_back(occ.doc);
+        }
+        std::sort(docs.begin(), docs.end());
+        docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+        return docs;
+    }
+
+    // Purges tombstones from every list and renumbers live documents densely.
+    void compactAll() {
+        std::vector<uint32_t> renumber(docs_.size());
+        std::vector<DocInfo> live;
+        live.reserve(liveDocs_);
+        for (uint32_t doc = 0; doc < docs_.size(); ++doc) {
+            if (!docs_[doc].file) continue;
+            renumber[doc] = static_cast<uint32_t>(live.size());
+            docIds_[docs_[doc].file] = renumber[doc];
+            live.push_back(docs_[doc]);
+        }
+        for (auto& posting : postings_) posting.compact(docs_, &renumber);
+        docs_.swap(live);
+    }
+
+    std::vector<DocInfo> docs_;
+    std::unordered_map<const FileNode*, uint32_t> docIds_;
+    std::unordered_map<std::string, uint32_t> terms_;
+    std::vector<Posting> postings_;
+    size_t liveDocs_ = 0;
+};
+
+} // namespace detail
+
+// --- Tree Diff ---
+/**
+ * @enum DiffKind
+ * @brief Kind of change reported by FileSystem::diff.
+ */
+enum class DiffKind { Added, Removed, Modified, Renamed };
+
+/**
+ * @struct DiffEntry
+ * @brief One change between two subtrees. Paths are relative to the compared roots and start with '/'.
+ */
+struct DiffEntry {
+    DiffKind kind;
+    NodeType type;
+    std::string path;    // Path in the new tree (in the old tree for Removed)
+    std::string oldPath; // Previous path for Renamed entries, empty otherwise
+};
+
+// --- Delta Sync ---
+namespace detail {
+
+/**
+ * @brief rsync's weak rolling checksum over a window: two 16-bit sums packed into 32 bits.
+ */
+class RollingChecksum {
+public:
+    void reset(const char* data, size_t n) {
+        a_ = b_ = 0;
+        length_ = static_cast<uint32_t>(n);
+        for (size_t i = 0; i < n; ++i) {
+            a_ += static_cast<unsigned char>(data[i]);
+            b_ += static_cast<uint32_t>(n - i) * static_cast<unsigned char>(data[i]);
+        }
+    }
+    void roll(char out, char in) {
+        a_ += static_cast<unsigned char>(in) - static_cast<uint32_t>(static_cast<unsigned char>(out));
+        b_ += a_ - length_ * static_cast<unsigned char>(out);
+    }
+    uint32_t value() const { return (a_ & 0xFFFF) | (b_ << 16); }
+
+private:
+    uint32_t a_ = 0;
+    uint32_t b_ = 0;
+    uint32_t length_ = 0;
+};
+
+} // namespace detail
+
+/**
+ * @struct SyncOptions
+ * @brief Controls FileSystem::makeSyncDelta and FileSystem::sync.
+ */
+struct SyncOptions {
+    size_t blockSize = 4096;       // Block size used for rolling-checksum matching
+    bool deleteExtraneous = true;  // Remove destination entries that do not exist in the source
+};
+
+/**
+ * @struct SyncStats
+ * @brief What applying a SyncDelta did.
+ */
+struct SyncStats {
+    size_t directoriesCreated = 0;
+    size_t filesWritten = 0;   // Files sent in full (new, or no usable basis)
+    size_t filesPatched = 0;   // Files rebuilt from basis blocks plus literal bytes
+    size_t entriesRemoved = 0;
+    size_t symlinksCreated = 0;
+    size_t literalBytes = 0;   // Bytes carried in the delta
+    size_t matchedBytes = 0;   // Bytes reused from the destination's existing content
+};
+
+/**
+ * @class SyncDelta
+ * @brief A serializable list of operations that turns a destination subtree into a copy of a source.
+ * @details Paths are relative to the synchronized roots and start with `/`; `/` is the root itself.
+ *          Modified files are expressed as runs of basis blocks (already present at the destination)
+ *          interleaved with literal bytes.
+ */
+class SyncDelta {
+public:
+    enum class OpType : uint8_t { MakeDir = 1, Remove = 2, WriteFile = 3, PatchFile = 4, MakeSymlink = 5 };
+
+    struct Chunk {
+        uint64_t firstBlock = 0; // Copy `blockCount` basis blocks starting here...
+        uint64_t blockCount = 0;
+        std::string literal;     // ...or, when blockCount == 0, insert these bytes.
+    };
+
+    struct Op {
+        OpType type;
+        std::string path;
+        std::string data;          // Full content for WriteFile, target for MakeSymlink
+        std::vector<Chunk> chunks; // Instructions for PatchFile
+    };
+
+    uint64_t blockSize = 0;
+    std::vector<Op> ops;
+
+    /**
+     * @brief Writes the delta as a self-delimiting binary frame, so several deltas can share a stream.
+     */
+    void serialize(std::ostream& out) const {
+        std::string payload;
+        detail::BinaryWriter writer(payload);
+        writer.varint(blockSize);
+        writer.varint(ops.size());
+        for (const auto& op : ops) {
+            writer.u8(static_cast<uint8_t>(op.type));
+            writer.string(op.path);
+            if (op.type == OpType::WriteFile || op.type == OpType::MakeSymlink) writer.string(op.data);
+            if (op.type == OpType::PatchFile) _writeChunks(writer, op.chunks);
+        }
+        std::string header(kMagic, sizeof(kMagic));
+        detail::BinaryWriter(header).u64(payload.size());
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        if (!out) throw FileSystemException("Failed to write sync delta.");
+    }
+
+    /**
+     * @brief Reads one delta frame written by serialize().
+     */
+    static SyncDelta deserialize(std::istream& in) {
+        char header[sizeof(kMagic) + 8];
+        if (!in.read(header, sizeof(header)) || std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+            throw FileSystemException("Stream does not contain a sync delta.");
+        }
+        const uint64_t length = detail::BinaryReader(std::string_view(header + sizeof(kMagic), 8)).u64();
+        const std::string payload = detail::readExactly(in, length, "Truncated sync delta.");
+        detail::BinaryReader reader(payload);
+        SyncDelta delta;
+        delta.blockSize = reader.varint();
+        delta.ops.resize(reader.count());
+        for (auto& op : delta.ops) {
+            op.type = static_cast<OpType>(reader.u8());
+            if (op.type < OpType::MakeDir || op.type > OpType::MakeSymlink) {
+                throw FileSystemException("Unknown operation in sync delta.");
+            }
+            op.path = reader.string();
+            if (!validPath(op.path)) throw FileSystemException("Invalid path in sync delta: " + op.path);
+            if (op.type == OpType::WriteFile || op.type == OpType::MakeSymlink) op.data = reader.string();
+            if (op.type == OpType::PatchFile) _readChunks(reader, op.chunks);
+        }
+        return delta;
+    }
+
+    /**
+     * @brief True if `path` is `/` or `/`-separated names without empty, `.` or `..` components, so
+     *        that joining it to a destination root cannot leave that subtree.
+     */
+    static bool validPath(std::string_view path) {
+        if (path.empty() || path[0] != '/') return false;
+        if (path.size() == 1) return true;
+        size_t start = 1;
+        for (;;) {
+            const size_t end = std::min(path.find('/', start), path.size());
+            const std::string_view name = path.substr(start, end - start);
+            if (name.empty() || name == "." || name == "..") return false;
+            if (end == path.size()) return true;
+            start = end + 1;
+        }
+    }
+
+    /**
+     * @brief Encodes the block size and the chunks of one PatchFile operation, as carried by
+     *        JournalOp::Patch entries.
+     */
+    static std::string encodePatch(uint64_t blockSize, const std::vector<Chunk>& chunks) {
+        std::string out;
+        detail::BinaryWriter writer(out);
+        writer.varint(blockSize);
+        _writeChunks(writer, chunks);
+        return out;
+    }
+
+    /**
+     * @brief Rebuilds a one-operation delta patching the absolute `path` from encodePatch() output.
+     *        Apply it with FileSystem::applySyncDelta("/", delta) to a tree holding the same basis.
+     */
+    static SyncDelta decodePatch(std::string_view encoded, std::string path) {
+        detail::BinaryReader reader(encoded);
+        SyncDelta delta;
+        delta.blockSize = reader.varint();
+        delta.ops.push_back({OpType::PatchFile, std::move(path), {}, {}});
+        _readChunks(reader, delta.ops.back().chunks);
+        return delta;
+    }
+
+private:
+    static constexpr char kMagic[8] = {'E', 'M', 'F', 'S', 'D', 'L', 'T', '1'};
+
+    static void _writeChunks(detail::BinaryWriter& writer, const std::vector<Chunk>& chunks) {
+        writer.varint(chunks.size());
+        for (const auto& chunk : chunks) {
+            writer.varint(chunk.blockCount);
+            if (chunk.blockCount) writer.varint(chunk.firstBlock);
+            else writer.string(chunk.literal);
+        }
+    }
+
+    static void _readChunks(detail::BinaryReader& reader, std::vector<Chunk>& chunks) {
+        chunks.resize(reader.count());
+        for (auto& chunk : chunks) {
+            chunk.blockCount = reader.varint();
+            if (chunk.blockCount) chunk.firstBlock = reader.varint();
+            else chunk.literal = reader.string();
+        }
+    }
+};
+
+// --- Content Search ---
+/**
+ * @enum GrepMode
+ * @brief Pattern interpretation for FileSystem::grep.
+ */
+enum class GrepMode {
+    Literal, // Pattern is matched byte-for-byte
+    Regex    // Simple regex: literals, '.', '[...]', '*', '+', '?', '^', '$' and '\' escapes
+};
+
+/**
+ * @struct GrepOptions
+ * @brief Controls how FileSystem::grep walks the tree and matches content.
+ */
+struct GrepOptions {
+    GrepMode mode = GrepMode::Literal;
+    bool recursive = true;        // Descend into subdirectories
+    size_t maxThreads = 0;        // 0 = use std::thread::hardware_concurrency()
+    size_t maxMatchesPerFile = 0; // 0 = report every match
+};
+
+/**
+ * @struct GrepMatch
+ * @brief A single match reported by FileSystem::grep.
+ */
+struct GrepMatch {
+    std::string path;     // Absolute path of the file containing the match
+    size_t offset = 0;    // Byte offset of the match within the file
+    size_t length = 0;    // Length of the matched bytes
+    size_t line = 0;      // 1-based line number of the match
+    std::string lineText; // Text of the matching line, without the trailing newline
+};
+
+namespace detail {
+
+/**
+ * @brief Portable substring search, used for short inputs and as the fallback path.
+ */
+inline const char* findScalar(const char* hay, size_t n, const char* needle, size_t m) {
+    if (m == 0) return hay;
+    if (m > n) return nullptr;
+    const char* end = hay + (n - m) + 1;
+    for (const char* p = hay; p < end; ++p) {
+        p = static_cast<const char*>(std::memchr(p, needle[0], static_cast<size_t>(end - p)));
+        if (!p) return nullptr;
+        if (std::memcmp(p + 1, needle + 1, m - 1) == 0) return p;
+    }
+    return nullptr;
+}
+
+#ifdef EMFS_X86_SIMD
+// Both SIMD variants compare the first and last needle byte against a whole block at once and
+// only verify the candidates whose two ends match, which skips most of the haystack cheaply.
+__attribute__((target("sse2")))
+inline const char* findSse2(const char* hay, size_t n, const char* needle, size_t m) {
+    if (m < 2 || m > n) return findScalar(hay, n, needle, m);
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        const __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+        const __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast))));
+        while (mask) {
+            const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (std::memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(hay + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+inline const char* findAvx2(const char* hay, size_t n, const char* needle, size_t m) {
+    if (m < 2 || m > n) return findScalar(hay, n, needle, m);
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        const __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+        const __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast))));
+        while (mask) {
+            const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (std::memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findSse2(hay + i, n - i, needle, m);
+}
+#endif
+
+/**
+ * @brief Finds the first occurrence of `needle` in `hay`, using the widest SIMD variant the CPU supports.
+ * @return Pointer to the match, or nullptr if there is none.
+ */
+inline const char* findSubstring(const char* hay, size_t n, const char* needle, size_t m) {
+    using FindFn = const char* (*)(const char*, size_t, const char*, size_t);
+#ifdef EMFS_X86_SIMD
+    static const FindFn impl = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? FindFn(&findAvx2) : FindFn(&findSse2);
+    }();
+#else
+    static const FindFn impl = &findScalar;
+#endif
+    return impl(hay, n, needle, m);
+}
+
+/**
+ * @class SimpleRegex
+ * @brief Small backtracking matcher for the GrepMode::Regex syntax.
+ * @details Matches never cross a newline. The longest literal run that every match must contain
+ *          is extracted at compile time so lines without it are skipped by the SIMD substring search.
+ */
+class SimpleRegex {
+public:
+    explicit SimpleRegex(std::string_view pattern) {
+        size_t i = 0;
+        if (i < pattern.size() && pattern[i] == '^') { anchoredStart_ = true; ++i; }
+        while (i < pattern.size()) {
+            if (pattern[i] == '$' && i + 1 == pattern.size()) { anchoredEnd_ = true; break; }
+            Token token;
+            const char c = pattern[i++];
+            if (c == '.') {
+                token.set.set();
+                token.set.reset('\n');
+            } else if (c == '[') {
+                bool negate = false;
+                if (i < pattern.size() && pattern[i] == '^') { negate = true; ++i; }
+                bool first = true;
+                while (i < pattern.size() && (pattern[i] != ']' || first)) {
+                    unsigned char lo = static_cast<unsigned char>(pattern[i++]);
+                    if (lo == '\\' && i < pattern.size()) lo = static_cast<unsigned char>(pattern[i++]);
+                    unsigned char hi = lo;
+                    if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+                        hi = static_cast<unsigned char>(pattern[i + 1]);
+                        i += 2;
+                    }
+                    for (unsigned v = lo; v <= hi; ++v) token.set.set(v);
+                    first = false;
+                }
+                if (i >= pattern.size()) throw FileSystemException("Unterminated character class in pattern.");
+                ++i; // Skip ']'
+                if (negate) { token.set.flip(); token.set.reset('\n'); }
             } else {
-                // Destination exists and is a file.
-                throw FileSystemException("Destination file already exists: " + std::string(dest_path));
+                char literal = c;
+                if (c == '\\') {
+                    if (i >= pattern.size()) throw FileSystemException("Pattern cannot end with a backslash.");
+                    literal = pattern[i++];
+                } else if (c == '*' || c == '+' || c == '?') {
+                    throw FileSystemException("Quantifier without a preceding atom in pattern.");
+                }
+                token.set.set(static_cast<unsigned char>(literal));
+                token.literal = literal;
+                token.isLiteral = true;
+            }
+            if (i < pattern.size() && (pattern[i] == '*' || pattern[i] == '+' || pattern[i] == '?')) {
+                token.min = pattern[i] == '+' ? 1 : 0;
+                token.max = pattern[i] == '?' ? 1 : SIZE_MAX;
+                ++i;
+            }
+            tokens_.push_back(token);
+        }
+
+        // Longest run of single, mandatory literals: every match contains it.
+        std::string run;
+        for (const auto& token : tokens_) {
+            if (token.isLiteral && token.min == 1 && token.max == 1) {
+                run.push_back(token.literal);
+            } else {
+                if (run.size() > required_.size()) required_ = run;
+                run.clear();
             }
-        } catch (const FileSystemException&) {
-            // Destination path does not fully exist, resolve its parent.
-            return _resolveParentAndName(dest_path);
         }
+        if (run.size() > required_.size()) required_ = run;
     }
 
+    /// Literal that every match contains (may be empty).
+    const std::string& requiredLiteral() const { return required_; }
 
-    void _recursiveCopy(const std::shared_ptr<DirectoryNode>& source, std::shared_ptr<DirectoryNode>& dest) const {
-        for (const auto& [name, child] : source->children) {
-            if (child->getType() == NodeType::File) {
-                auto oldFile = std::static_pointer_cast<FileNode>(child);
-                auto newFile = std::make_shared<FileNode>(oldFile->name, dest);
-                newFile->content = oldFile->content;
-                dest->children[newFile->name] = newFile;
+    /**
+     * @brief Finds the leftmost match in [begin, end) starting at or after `from`.
+     * @return true and sets `matchBegin`/`matchEnd` on success.
+     */
+    bool search(const char* begin, const char* end, const char* from,
+                const char*& matchBegin, const char*& matchEnd) const {
+        for (const char* start = from; start <= end; ++start) {
+            if (anchoredStart_ && start != begin) return false;
+            const char* stop = nullptr;
+            if (matchHere(0, start, end, stop)) {
+                matchBegin = start;
+                matchEnd = stop;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Token {
+        std::bitset<256> set;
+        char literal = 0;
+        bool isLiteral = false;
+        size_t min = 1;
+        size_t max = 1;
+    };
+
+    bool matchHere(size_t t, const char* p, const char* end, const char*& stop) const {
+        if (t == tokens_.size()) {
+            if (anchoredEnd_ && p != end) return false;
+            stop = p;
+            return true;
+        }
+        const Token& token = tokens_[t];
+        size_t count = 0;
+        while (count < token.max && p + count < end &&
+               token.set.test(static_cast<unsigned char>(p[count]))) {
+            ++count;
+        }
+        // Greedy: try the longest repetition first and back off.
+        for (size_t k = count + 1; k-- > token.min;) {
+            if (matchHere(t + 1, p + k, end, stop)) return true;
+        }
+        return false;
+    }
+
+    std::vector<Token> tokens_;
+    std::string required_;
+    bool anchoredStart_ = false;
+    bool anchoredEnd_ = false;
+};
+
+/**
+ * @brief Runs `work(i)` for every i in [0, count) on up to `maxThreads` threads.
+ */
+template <typename Work>
+void parallelFor(size_t count, size_t maxThreads, Work&& work) {
+    size_t threads = maxThreads ? maxThreads : std::max<size_t>(1, std::thread::hardware_concurrency());
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) work(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+             i = next.fetch_add(1, std::memory_order_relaxed)) {
+            work(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (size_t t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+}
+
+} // namespace detail
+
+// --- Change Notification ---
+/**
+ * @enum WatchMask
+ * @brief Event kinds for FileSystem::watch; combine with `|` to build a mask.
+ */
+enum WatchMask : uint32_t {
+    WatchCreate = 1u << 0,
+    WatchModify = 1u << 1,
+    WatchDelete = 1u << 2,
+    WatchMove = 1u << 3,
+    WatchAttrib = 1u << 4, // Metadata only: touch, chmod, chown
+    WatchAll = WatchCreate | WatchModify | WatchDelete | WatchMove | WatchAttrib,
+    WatchOverflow = 1u << 14 // Always delivered after events were dropped, like IN_Q_OVERFLOW
+};
+
+/**
+ * @struct WatchEvent
+ * @brief A change observed by a watch.
+ */
+struct WatchEvent {
+    WatchMask type = WatchOverflow;
+    NodeType nodeType = NodeType::File;
+    std::string path;    // Affected path (destination for WatchMove; empty for WatchOverflow)
+    std::string oldPath; // Source path for WatchMove
+};
+
+namespace detail {
+
+/**
+ * @class MpmcQueue
+ * @brief Bounded lock-free multi-producer/multi-consumer queue (Vyukov's sequence-number design).
+ * @details Neither side ever blocks: tryPush fails when the queue is full and tryPop when it is empty.
+ */
+template <typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        mask_ = size - 1;
+        for (size_t i = 0; i < size; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T&& value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full
             } else {
-                auto oldDir = std::static_pointer_cast<DirectoryNode>(child);
-                auto newDir = std::make_shared<DirectoryNode>(oldDir->name, dest);
-                dest->children[newDir->name] = newDir;
-                _recursiveCopy(oldDir, newDir);
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& out) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(cell.value);
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Empty
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
             }
         }
     }
 
-public:
-    FileSystem() : root(std::make_shared<DirectoryNode>("/", nullptr)) {}
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+} // namespace detail
+
+/**
+ * @class Watcher
+ * @brief A registered watch. Events are either queued for poll() or passed to a callback.
+ * @details The queue is bounded and lock-free: the mutating thread never blocks on a slow consumer.
+ *          When it is full, events are dropped and a single WatchOverflow event is queued as soon as
+ *          there is room again. Watches are bound to a path, not to the node currently there.
+ */
+class Watcher {
+public:
+    using Callback = std::function<void(const WatchEvent&)>;
+
+    Watcher(std::string path, bool recursive, uint32_t mask, size_t capacity, Callback callback)
+        : path_(std::move(path)), recursive_(recursive), mask_(mask), callback_(std::move(callback)) {
+        if (!callback_) queue_ = std::make_unique<detail::MpmcQueue<WatchEvent>>(capacity);
+    }
+
+    /// Takes the next queued event; returns false when none is pending.
+    bool poll(WatchEvent& event) { return queue_ && queue_->tryPop(event); }
+
+    /// Moves up to `max` pending events into `out` and returns how many were taken.
+    size_t drain(std::vector<WatchEvent>& out, size_t max = SIZE_MAX) {
+        size_t taken = 0;
+        for (WatchEvent event; taken < max && poll(event); ++taken) out.push_back(std::move(event));
+        return taken;
+    }
+
+    /// Number of events dropped because the queue was full.
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    const std::string& path() const { return path_; }
+
+    /// True if an event at `path` falls within this watch.
+    bool covers(std::string_view path) const {
+        if (path == path_) return true;
+        const std::string_view base = path_ == "/" ? std::string_view() : std::string_view(path_);
+        if (path.size() <= base.size() + 1 || path.compare(0, base.size(), base) != 0 || path[base.size()] != '/') {
+            return false;
+        }
+        return recursive_ || path.find('/', base.size() + 1) == std::string_view::npos;
+    }
+
+    void deliver(WatchEvent event) {
+        if (!(mask_ & event.type)) return;
+        if (callback_) {
+            callback_(event);
+            return;
+        }
+        if (overflowed_.load(std::memory_order_relaxed)) {
+            if (!overflowed_.exchange(false, std::memory_order_acq_rel)) {
+                // Another producer is reporting the overflow.
+            } else if (!queue_->tryPush(WatchEvent{})) {
+                overflowed_.store(true, std::memory_order_release);
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        if (!queue_->tryPush(std::move(event))) {
+            overflowed_.store(true, std::memory_order_release);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::string path_;
+    bool recursive_;
+    uint32_t mask_;
+    Callback callback_;
+    std::unique_ptr<detail::MpmcQueue<WatchEvent>> queue_;
+    std::atomic<bool> overflowed_{false};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+// --- Change Journal ---
+/**
+ * @enum JournalOp
+ * @brief Mutation recorded in the change journal.
+ */
+enum class JournalOp : uint8_t { Mkdir = 1, Touch, Write, Append, Remove, Copy, Move, Chmod, Chown, Link, Symlink, Retarget,
+                                 SetXattr, RemoveXattr, Patch };
+
+/**
+ * @struct JournalEntry
+ * @brief One mutation, as issued against the FileSystem API.
+ */
+struct JournalEntry {
+    uint64_t sequence = 0;  // Monotonically increasing, starting at 1
+    int64_t timestamp = 0;  // Nanoseconds since the Unix epoch
+    JournalOp op = JournalOp::Mkdir;
+    bool recursive = false; // For Remove
+    std::string path;
+    std::string target;     // Destination for Copy, Move and Link; link target for Symlink and Retarget;
+                            // attribute name for SetXattr and RemoveXattr
+    uint64_t argument = 0;  // Mode for Chmod; (uid << 32) | gid for Chown
+    // Payload for Write, Append and SetXattr; for Patch, a file rebuilt by applySyncDelta, the
+    // SyncDelta::encodePatch() chunks, which refer to blocks of the file's previous content. File
+    // content is mutable in place, so the bytes are copied once when the entry is recorded; every
+    // cursor and read then shares that copy.
+    std::shared_ptr<const std::vector<char>> data;
+};
+
+/**
+ * @struct JournalOptions
+ * @brief Retention bounds for the change journal; the oldest entries are dropped first.
+ */
+struct JournalOptions {
+    size_t maxEntries = 1 << 16;
+    size_t maxBytes = size_t(64) << 20; // Payload bytes retained
+};
+
+/**
+ * @struct JournalCursor
+ * @brief A subscriber's read position: the sequence number it will read next.
+ */
+struct JournalCursor {
+    uint64_t next = 1;
+};
+
+namespace detail {
+
+/**
+ * @class ChangeJournal
+ * @brief Ordered, bounded, in-memory mutation log with independent reader cursors.
+ * @details Guarded by its own mutex so readers on other threads can catch up while the owning thread
+ *          keeps mutating the file system.
+ */
+class ChangeJournal {
+public:
+    explicit ChangeJournal(JournalOptions options) : options_(options) {}
+
+    void record(JournalEntry entry) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entry.sequence = nextSequence_++;
+        entry.timestamp = nowNanos();
+        bytes_ += entry.data ? entry.data->size() : 0;
+        entries_.push_back(std::move(entry));
+        while (!entries_.empty() && (entries_.size() > options_.maxEntries || bytes_ > options_.maxBytes)) {
+            bytes_ -= entries_.front().data ? entries_.front().data->size() : 0;
+            entries_.pop_front();
+        }
+    }
+
+    size_t read(JournalCursor& cursor, std::vector<JournalEntry>& out, size_t max) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const uint64_t first = entries_.empty() ? nextSequence_ : entries_.front().sequence;
+        if (cursor.next < first) {
+            throw FileSystemException("Journal cursor at " + std::to_string(cursor.next) +
+                                      " fell behind retention (oldest retained: " + std::to_string(first) + ").");
+        }
+        size_t taken = 0;
+        for (uint64_t seq = cursor.next; seq < nextSequence_ && taken < max; ++seq, ++taken) {
+            out.push_back(entries_[seq - first]);
+        }
+        cursor.next += taken;
+        return taken;
+    }
+
+    uint64_t firstSequence() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.empty() ? nextSequence_ : entries_.front().sequence;
+    }
+
+    uint64_t nextSequence() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return nextSequence_;
+    }
+
+private:
+    JournalOptions options_;
+    mutable std::mutex mutex_;
+    std::deque<JournalEntry> entries_;
+    uint64_t nextSequence_ = 1;
+    size_t bytes_ = 0;
+};
+
+} // namespace detail
+
+// --- Expiry ---
+namespace detail {
+
+inline unsigned countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+    unsigned n = 0;
+    for (; !(x & 1); x >>= 1) ++n;
+    return n;
+#endif
+}
+
+inline unsigned countLeadingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_clzll(x));
+#else
+    unsigned n = 0;
+    for (uint64_t bit = uint64_t(1) << 63; !(x & bit); bit >>= 1) ++n;
+    return n;
+#endif
+}
+
+/**
+ * @class TimerWheel
+ * @brief Hierarchical timing wheel over integer ticks: 6 levels of 64 slots, plus an overflow list.
+ * @details A timer sits on the level of the highest base-64 digit in which its due tick differs from
+ *          the current tick, in the slot of that digit. When the wheel reaches the start of that slot's
+ *          span, the timer cascades to a lower level, so it moves at most once per level before it
+ *          fires. Scheduling is O(1), and per-level occupancy bitmaps let advance() skip straight to
+ *          the next non-empty slot however long the wheel sat idle. Timers are never cancelled;
+ *          owners validate them when they fire.
+ */
+template <typename T>
+class TimerWheel {
+public:
+    static constexpr unsigned kLevels = 6;
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr uint64_t kSlots = uint64_t(1) << kSlotBits;
+
+    explicit TimerWheel(uint64_t now) : now_(now) {}
+
+    size_t size() const { return size_; }
+
+    void schedule(uint64_t due, T value) {
+        _place({due, std::move(value)});
+        ++size_;
+    }
+
+    /// Moves the wheel to `now`, calling fn(value) for every timer due at or before it, in due order.
+    template <typename Fn>
+    void advance(uint64_t now, Fn&& fn) {
+        _fire(overdue_, fn);
+        while (size_ > 0) {
+            const uint64_t next = _nextEvent();
+            if (next > now) break;
+            now_ = next;
+            if ((now_ & (_span(kLevels) - 1)) == 0) _cascade(far_);
+            for (unsigned level = kLevels - 1; level > 0; --level) {
+                if ((now_ & (_span(level) - 1)) == 0) _cascadeSlot(level, (now_ >> (kSlotBits * level)) & (kSlots - 1));
+            }
+            const uint64_t slot = now_ & (kSlots - 1);
+            occupied_[0] &= ~(uint64_t(1) << slot);
+            _fire(slots_[0][slot], fn);
+            _fire(overdue_, fn);
+        }
+        if (now > now_) now_ = now;
+    }
+
+private:
+    struct Timer {
+        uint64_t due;
+        T value;
+    };
+
+    static constexpr uint64_t _span(unsigned level) { return uint64_t(1) << (kSlotBits * level); }
+
+    void _place(Timer timer) {
+        if (timer.due <= now_) {
+            overdue_.push_back(std::move(timer));
+            return;
+        }
+        const uint64_t differing = timer.due ^ now_;
+        unsigned level = 0;
+        while (level < kLevels && differing >= _span(level + 1)) ++level;
+        if (level == kLevels) {
+            far_.push_back(std::move(timer));
+            return;
+        }
+        const uint64_t slot = (timer.due >> (kSlotBits * level)) & (kSlots - 1);
+        slots_[level][slot].push_back(std::move(timer));
+        occupied_[level] |= uint64_t(1) << slot;
+    }
+
+    // The earliest tick after now_ at which some slot must be cascaded or fired.
+    uint64_t _nextEvent() const {
+        uint64_t next = overdue_.empty() ? UINT64_MAX : now_;
+        for (unsigned level = 0; level < kLevels; ++level) {
+            const uint64_t mask = occupied_[level];
+            if (!mask) continue;
+            const unsigned shift = kSlotBits * level;
+            const uint64_t base = (now_ >> shift) + 1;
+            const unsigned digit = static_cast<unsigned>(base & (kSlots - 1));
+            const uint64_t rotated = digit ? (mask >> digit) | (mask << (kSlots - digit)) : mask;
+            next = std::min(next, (base + countTrailingZeros(rotated)) << shift);
+        }
+        if (!far_.empty()) next = std::min(next, ((now_ >> (kSlotBits * kLevels)) + 1) << (kSlotBits * kLevels));
+        return next;
+    }
+
+    void _cascadeSlot(unsigned level, uint64_t slot) {
+        if (!(occupied_[level] & (uint64_t(1) << slot))) return;
+        occupied_[level] &= ~(uint64_t(1) << slot);
+        _cascade(slots_[level][slot]);
+    }
+
+    void _cascade(std::vector<Timer>& timers) {
+        std::vector<Timer> moving;
+        moving.swap(timers);
+        for (auto& timer : moving) _place(std::move(timer));
+    }
+
+    template <typename Fn>
+    void _fire(std::vector<Timer>& timers, Fn& fn) {
+        if (timers.empty()) return;
+        std::vector<Timer> due;
+        due.swap(timers);
+        size_ -= due.size();
+        for (auto& timer : due) fn(std::move(timer.value));
+    }
+
+    uint64_t now_;
+    size_t size_ = 0;
+    std::array<uint64_t, kLevels> occupied_{};
+    std::array<std::array<std::vector<Timer>, kSlots>, kLevels> slots_;
+    std::vector<Timer> overdue_; // Scheduled at or before now_
+    std::vector<Timer> far_;     // Due beyond the top level's span
+};
+
+/**
+ * @class Reclaimer
+ * @brief Frees detached subtrees on a background thread, so expiring a large tree does not stall the
+ *        caller.
+ * @details Only nodes no longer reachable from the tree are handed over, and node destructors touch
+ *          nothing but the node itself, so the thread needs no access to the FileSystem.
+ */
+class Reclaimer {
+public:
+    Reclaimer() = default;
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+    ~Reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_one();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    void retire(std::shared_ptr<FSNode> node) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(std::move(node));
+            if (!thread_.joinable()) thread_ = std::thread([this] { _run(); });
+        }
+        ready_.notify_one();
+    }
+
+private:
+    void _run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            ready_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+            std::vector<std::shared_ptr<FSNode>> batch;
+            batch.swap(pending_);
+            lock.unlock();
+            batch.clear(); // Destructors run here, outside the lock
+            lock.lock();
+            if (stop_ && pending_.empty()) return;
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::vector<std::shared_ptr<FSNode>> pending_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+} // namespace detail
+
+// --- Operation Metrics ---
+/**
+ * @enum Op
+ * @brief The FileSystem operations that metrics are recorded for. Overloads and aliases that only
+ *        forward to another public method are recorded under that method. Getters of settings (such as
+ *        journalEnabled() or getAtimePolicy()) and the metrics, tracing and profiling accessors are not
+ *        recorded. New operations are appended, since workload traces store the value.
+ */
+enum class Op : uint8_t {
+    Mkdir, Touch, WriteFile, Append, Cat, Rm, Cp, Mv, Link, Symlink, Retarget, Readlink,
+    Ls, LsDetailed, Exists, GetNodeType, Size, Stat, Lstat, Checksum, TreeHash, SubtreeEquals, Diff,
+    MakeSyncDelta, ApplySyncDelta, EnableIndexes, Find, EnableFullTextIndex, Search, Watch,
+    SaveSnapshot, LoadSnapshot, ReadJournal, Chmod, Chown, SetLinkAccounting, HeatReport,
+    SetTtl, ClearTtl, Expire, Open, GetXattr, SetXattr, ListXattr, RemoveXattr, Grep, Execute,
+    Verify, DisableIndexes, DisableFullTextIndex, Unwatch, EnableJournal, DisableJournal, SubscribeJournal,
+    EnableHeatTracking, DisableHeatTracking, SetAtimePolicy, Count
+};
+
+constexpr size_t kOpCount = static_cast<size_t>(Op::Count);
+
+inline const char* opName(Op op) {
+    static constexpr const char* kNames[kOpCount] = {
+        "mkdir", "touch", "writeFile", "append", "cat", "rm", "cp", "mv", "link", "symlink", "retarget", "readlink",
+        "ls", "lsDetailed", "exists", "getNodeType", "size", "stat", "lstat", "checksum", "treeHash", "subtreeEquals", "diff",
+        "makeSyncDelta", "applySyncDelta", "enableIndexes", "find", "enableFullTextIndex", "search", "watch",
+        "saveSnapshot", "loadSnapshot", "readJournal", "chmod", "chown", "setLinkAccounting", "heatReport",
+        "setTtl", "clearTtl", "expire", "open", "getxattr", "setxattr", "listxattr", "removexattr", "grep", "execute",
+        "verify", "disableIndexes", "disableFullTextIndex", "unwatch", "enableJournal", "disableJournal",
+        "subscribeJournal", "enableHeatTracking", "disableHeatTracking", "setAtimePolicy"};
+    return op < Op::Count ? kNames[static_cast<size_t>(op)] : "unknown";
+}
+
+namespace detail {
+
+/// Log-linear latency buckets, as in HDR histograms: exact below 16, then 8 buckets per power of two.
+constexpr unsigned kLatencySubBits = 3;
+constexpr size_t kLatencyBuckets = (64 - kLatencySubBits + 1) << kLatencySubBits;
+
+inline size_t latencyBucket(uint64_t value) {
+    if (value < (uint64_t(2) << kLatencySubBits)) return static_cast<size_t>(value);
+    const unsigned exponent = 63 - countLeadingZeros(value);
+    const uint64_t mantissa = (value >> (exponent - kLatencySubBits)) & ((uint64_t(1) << kLatencySubBits) - 1);
+    return ((exponent - kLatencySubBits + 1) << kLatencySubBits) + static_cast<size_t>(mantissa);
+}
+
+/// Smallest value that falls into `bucket`.
+inline uint64_t latencyBucketFloor(size_t bucket) {
+    if (bucket < (size_t(2) << kLatencySubBits)) return bucket;
+    const unsigned exponent = static_cast<unsigned>(bucket >> kLatencySubBits) + kLatencySubBits - 1;
+    const uint64_t mantissa = bucket & ((size_t(1) << kLatencySubBits) - 1);
+    return ((uint64_t(1) << kLatencySubBits) | mantissa) << (exponent - kLatencySubBits);
+}
+
+class MetricsRegistry;
+
+} // namespace detail
+
+/**
+ * @class LatencyHistogram
+ * @brief Merged latency distribution of one operation, in nanoseconds.
+ * @details Buckets are log-linear with 8 sub-buckets per power of two, so percentiles are within
+ *          12.5% of the true value.
+ */
+class LatencyHistogram {
+public:
+    uint64_t count() const { return count_; }
+    double mean() const { return count_ ? static_cast<double>(sum_) * nsPerTick_ / static_cast<double>(count_) : 0; }
+    double max() const { return static_cast<double>(max_) * nsPerTick_; }
+
+    /// The latency below which a fraction `q` (0..1) of calls completed, at bucket-midpoint precision.
+    double percentile(double q) const {
+        if (count_ == 0) return 0;
+        const auto rank = static_cast<uint64_t>(std::max(1.0, std::ceil(std::min(q, 1.0) * static_cast<double>(count_))));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < buckets_.size(); ++b) {
+            seen += buckets_[b];
+            if (seen < rank) continue;
+            const double low = static_cast<double>(detail::latencyBucketFloor(b));
+            const double high = b + 1 < detail::kLatencyBuckets ? static_cast<double>(detail::latencyBucketFloor(b + 1)) : low;
+            return std::min((low + high) / 2, static_cast<double>(max_)) * nsPerTick_;
+        }
+        return max();
+    }
+
+private:
+    friend class detail::MetricsRegistry;
+    std::vector<uint64_t> buckets_ = std::vector<uint64_t>(detail::kLatencyBuckets);
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0; // Ticks
+    uint64_t max_ = 0; // Ticks
+    double nsPerTick_ = 1;
+};
+
+/**
+ * @struct OpMetrics
+ * @brief Calls, failures (calls that threw) and latency of one operation.
+ */
+struct OpMetrics {
+    Op op = Op::Count;
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    LatencyHistogram latency;
+};
+
+/**
+ * @struct Metrics
+ * @brief Snapshot returned by FileSystem::metrics(): one entry per operation called at least once.
+ * @details `enabled` is false, and `ops` empty, unless the header was compiled with EMFS_ENABLE_METRICS.
+ */
+struct Metrics {
+    bool enabled = false;
+    std::vector<OpMetrics> ops;
+
+    const OpMetrics* find(Op op) const {
+        for (const auto& m : ops) {
+            if (m.op == op) return &m;
+        }
+        return nullptr;
+    }
+};
+
+#ifdef EMFS_ENABLE_METRICS
+namespace detail {
+
+/// A cheap monotonic tick: the TSC on x86, nanoseconds elsewhere. See ticksToNanos().
+inline uint64_t readTicks() {
+#ifdef EMFS_X86_SIMD
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+/// Nanoseconds per tick, calibrated once against steady_clock (a 10 ms wait on first use).
+inline double nanosPerTick() {
+#ifdef EMFS_X86_SIMD
+    static const double ratio = [] {
+        const auto wallStart = std::chrono::steady_clock::now();
+        const uint64_t tickStart = readTicks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        const double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - wallStart).count();
+        const uint64_t ticks = readTicks() - tickStart;
+        return ticks ? nanos / static_cast<double>(ticks) : 1.0;
+    }();
+    return ratio;
+#else
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::duration(1)).count();
+#endif
+}
+
+/**
+ * @class MetricsRegistry
+ * @brief Per-FileSystem metrics, recorded into one shard per thread and merged when read.
+ * @details Each thread writes only its own shard, with relaxed loads and stores rather than atomic
+ *          read-modify-writes, so recording takes no lock and shares no cache line. A thread finds
+ *          its shard through a one-entry thread-local cache keyed by registry id. Per-operation
+ *          counters are allocated the first time the thread records that operation.
+ */
+class MetricsRegistry {
+public:
+    MetricsRegistry() : id_(nextId()) {}
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    void record(Op op, uint64_t ticks, bool failed) noexcept {
+        Shard* shard = _shard();
+        if (!shard) return;
+        OpCounters* counters = shard->ops[static_cast<size_t>(op)].load(std::memory_order_acquire);
+        if (!counters) {
+            counters = new (std::nothrow) OpCounters();
+            if (!counters) return;
+            shard->ops[static_cast<size_t>(op)].store(counters, std::memory_order_release);
+        }
+        bump(counters->calls, 1);
+        if (failed) bump(counters->errors, 1);
+        bump(counters->ticks, ticks);
+        if (ticks > counters->maxTicks.load(std::memory_order_relaxed)) counters->maxTicks.store(ticks, std::memory_order_relaxed);
+        bump(counters->buckets[latencyBucket(ticks)], 1);
+    }
+
+    Metrics snapshot() const {
+        Metrics metrics;
+        metrics.enabled = true;
+        std::array<OpMetrics, kOpCount> merged;
+        const double nsPerTick = nanosPerTick();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& shard : shards_) {
+                for (size_t op = 0; op < kOpCount; ++op) {
+                    const OpCounters* counters = shard->ops[op].load(std::memory_order_acquire);
+                    if (!counters) continue;
+                    OpMetrics& m = merged[op];
+                    m.calls += counters->calls.load(std::memory_order_relaxed);
+                    m.errors += counters->errors.load(std::memory_order_relaxed);
+                    LatencyHistogram& h = m.latency;
+                    h.sum_ += counters->ticks.load(std::memory_order_relaxed);
+                    h.max_ = std::max(h.max_, counters->maxTicks.load(std::memory_order_relaxed));
+                    for (size_t b = 0; b < kLatencyBuckets; ++b) {
+                        const uint64_t n = counters->buckets[b].load(std::memory_order_relaxed);
+                        h.buckets_[b] += n;
+                        h.count_ += n;
+                    }
+                }
+            }
+        }
+        for (size_t op = 0; op < kOpCount; ++op) {
+            if (merged[op].calls == 0) continue;
+            merged[op].op = static_cast<Op>(op);
+            merged[op].latency.nsPerTick_ = nsPerTick;
+            metrics.ops.push_back(std::move(merged[op]));
+        }
+        return metrics;
+    }
+
+private:
+    struct OpCounters {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> ticks{0};
+        std::atomic<uint64_t> maxTicks{0};
+        std::array<std::atomic<uint64_t>, kLatencyBuckets> buckets{};
+    };
+
+    struct Shard {
+        std::array<std::atomic<OpCounters*>, kOpCount> ops{};
+        ~Shard() {
+            for (auto& counters : ops) delete counters.load(std::memory_order_relaxed);
+        }
+    };
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Shard* _shard() noexcept {
+        struct Cached {
+            uint64_t owner = 0;
+            Shard* shard = nullptr;
+        };
+        thread_local Cached cached;
+        if (cached.owner == id_) return cached.shard;
+        try {
+            // Ids are never reused, so entries left by destroyed registries are never matched again.
+            thread_local std::unordered_map<uint64_t, Shard*> shards;
+            Shard*& shard = shards[id_];
+            if (!shard) {
+                auto owned = std::make_unique<Shard>();
+                shard = owned.get();
+                std::lock_guard<std::mutex> lock(mutex_);
+                shards_.push_back(std::move(owned));
+            }
+            cached = {id_, shard};
+            return shard;
+        } catch (...) {
+            return nullptr;
+        }
+    }
+
+    const uint64_t id_;
+    mutable std::mutex mutex_;                  // Guards shards_ (not the counters)
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+/**
+ * @class OpScope
+ * @brief Times one public FileSystem call and records it, as failed if it ends by throwing.
+ */
+class OpScope {
+public:
+    OpScope(MetricsRegistry& registry, Op op) noexcept
+        : registry_(registry), op_(op), exceptions_(std::uncaught_exceptions()), start_(readTicks()) {}
+    OpScope(const OpScope&) = delete;
+    OpScope& operator=(const OpScope&) = delete;
+    ~OpScope() { registry_.record(op_, readTicks() - start_, std::uncaught_exceptions() > exceptions_); }
+
+private:
+    MetricsRegistry& registry_;
+    Op op_;
+    int exceptions_;
+    uint64_t start_;
+};
+
+} // namespace detail
+
+#define EMFS_METRICS_OP_(op) ::e_mfs::detail::OpScope emfsOpScope_(metricsRegistry, ::e_mfs::Op::op);
+#else
+#define EMFS_METRICS_OP_(op)
+#endif
+
+// --- Tracing ---
+/**
+ * @enum TracePhase
+ * @brief What a trace event covers: a whole public operation, or an internal phase of one.
+ * @details Resolve is one path lookup, Copy the node copy made by cp(), Destroy the release of a
+ *          node removed from the tree. Nodes removed by expiry are freed later on the reclaimer
+ *          thread, so their Destroy phase covers only the hand-off.
+ */
+enum class TracePhase : uint8_t { Operation, Resolve, Copy, Destroy };
+
+inline const char* tracePhaseName(TracePhase phase) {
+    switch (phase) {
+        case TracePhase::Operation: return "operation";
+        case TracePhase::Resolve: return "resolve";
+        case TracePhase::Copy: return "copy";
+        case TracePhase::Destroy: return "destroy";
+    }
+    return "unknown";
+}
+
+/**
+ * @struct TraceEvent
+ * @brief One begin or end event passed to a TraceSink.
+ * @details `op` is the public operation the event belongs to, for phases too. `path` and `target`
+ *          (the second path of cp, mv, link, symlink and retarget) are set on begin events only and
+ *          are valid only during the call, as is `content`, the data given to writeFile or append.
+ *          `bytes` and `failed` (the operation or phase threw) are set on end events. `timestamp`
+ *          is steady-clock nanoseconds.
+ */
+struct TraceEvent {
+    Op op = Op::Count;
+    TracePhase phase = TracePhase::Operation;
+    std::string_view path;
+    std::string_view target;
+    std::string_view content;
+    uint64_t bytes = 0;
+    bool recursive = false; // rm's flag, reported by its end event
+    bool failed = false;
+    int64_t timestamp = 0;
+};
+
+/**
+ * @class TraceSink
+ * @brief Receives the begin/end events of every traced operation; see FileSystem::setTraceSink().
+ * @details Events nest: a phase's begin and end fall between those of its operation. Const
+ *          operations may run concurrently, so a sink shared by readers must be thread-safe.
+ *          Exceptions thrown by a sink are discarded.
+ */
+class TraceSink {
+public:
+    virtual ~TraceSink() = default;
+    virtual void begin(const TraceEvent& event) = 0;
+    virtual void end(const TraceEvent& event) = 0;
+};
+
+#ifdef EMFS_ENABLE_TRACING
+namespace detail {
+
+/// The sink and operation of the innermost traced operation running on this thread.
+struct TraceContext {
+    TraceSink* sink = nullptr;
+    Op op = Op::Count;
+};
+
+inline TraceContext& traceContext() noexcept {
+    thread_local TraceContext context;
+    return context;
+}
+
+/**
+ * @class TraceScope
+ * @brief Emits the begin event of an operation or phase on construction and its end event on
+ *        destruction. Phases report to the sink of the enclosing operation, and are silent outside one.
+ */
+class TraceScope {
+public:
+    TraceScope(TraceSink* sink, Op op, std::string_view path, std::string_view target = {},
+               std::string_view content = {}) noexcept
+        : saved_(traceContext()) {
+        traceContext() = {sink, op};
+        _begin(TracePhase::Operation, path, target, content);
+    }
+
+    TraceScope(TracePhase phase, std::string_view path, uint64_t bytes = 0) noexcept
+        : saved_(traceContext()), restore_(false) {
+        event_.bytes = bytes;
+        _begin(phase, path, {}, {});
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    ~TraceScope() {
+        const TraceContext context = traceContext();
+        if (restore_) traceContext() = saved_;
+        if (!context.sink) return;
+        event_.failed = std::uncaught_exceptions() > exceptions_;
+        event_.timestamp = _now();
+        try {
+            context.sink->end(event_);
+        } catch (...) {
+        }
+    }
+
+    void setBytes(uint64_t bytes) noexcept { event_.bytes = bytes; }
+    void setRecursive(bool recursive) noexcept { event_.recursive = recursive; }
+
+private:
+    void _begin(TracePhase phase, std::string_view path, std::string_view target, std::string_view content) noexcept {
+        const TraceContext& context = traceContext();
+        if (!context.sink) return;
+        exceptions_ = std::uncaught_exceptions();
+        event_.op = context.op;
+        event_.phase = phase;
+        TraceEvent begin = event_;
+        begin.path = path;
+        begin.target = target;
+        begin.content = content;
+        begin.bytes = 0;
+        begin.timestamp = _now();
+        try {
+            context.sink->begin(begin);
+        } catch (...) {
+        }
+    }
+
+    static int64_t _now() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    TraceContext saved_;
+    bool restore_ = true;
+    int exceptions_ = 0;
+    TraceEvent event_;
+};
+
+} // namespace detail
+
+#define EMFS_TRACE_OP_(op, ...) ::e_mfs::detail::TraceScope emfsTraceScope_(traceSink.get(), ::e_mfs::Op::op, __VA_ARGS__);
+// Sets the byte count reported by the end event of the enclosing operation.
+#define EMFS_OP_BYTES(bytes) emfsTraceScope_.setBytes(bytes)
+// Sets the recursive flag reported by the end event of the enclosing operation.
+#define EMFS_OP_RECURSIVE(recursive) emfsTraceScope_.setRecursive(recursive)
+// Traces the rest of the enclosing block as an internal phase of the current operation.
+#define EMFS_TRACE_PHASE(phase, ...) ::e_mfs::detail::TraceScope emfsPhaseScope_(::e_mfs::TracePhase::phase, __VA_ARGS__)
+#else
+#define EMFS_TRACE_OP_(op, ...)
+#define EMFS_OP_BYTES(bytes) ((void)0)
+#define EMFS_OP_RECURSIVE(recursive) ((void)0)
+#define EMFS_TRACE_PHASE(phase, ...) ((void)0)
+#endif
+
+// --- Allocation Profiling ---
+/**
+ * @struct OpAllocations
+ * @brief Heap allocations made by one operation: totals over all calls and the most made by one call.
+ */
+struct OpAllocations {
+    Op op = Op::Count;
+    uint64_t calls = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    uint64_t maxAllocations = 0; // In a single call; assert this to hold an operation to a budget
+    uint64_t maxBytes = 0;       // In a single call
+};
+
+/**
+ * @struct AllocationProfile
+ * @brief Snapshot returned by FileSystem::allocationProfile(): one entry per operation called at least once.
+ * @details `enabled` is false, and `ops` empty, unless the header was compiled with
+ *          EMFS_ENABLE_ALLOCATION_PROFILING and one translation unit installed the counting hooks.
+ */
+struct AllocationProfile {
+    bool enabled = false;
+    std::vector<OpAllocations> ops;
+
+    const OpAllocations* find(Op op) const {
+        for (const auto& m : ops) {
+            if (m.op == op) return &m;
+        }
+        return nullptr;
+    }
+};
+
+#ifdef EMFS_ENABLE_ALLOCATION_PROFILING
+/**
+ * @struct AllocationStats
+ * @brief Allocations counted on one thread, by the global operator new installed with
+ *        EMFS_DEFINE_ALLOCATION_HOOKS.
+ */
+struct AllocationStats {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+namespace detail {
+
+/// This thread's running totals; constant-initialized, so operator new can use it at any time.
+inline thread_local AllocationStats threadAllocations{};
+
+/// Set by the hooks translation unit during static initialization.
+inline std::atomic<bool> allocationHooksInstalled{false};
+
+inline void countAllocation(size_t bytes) noexcept {
+    ++threadAllocations.allocations;
+    threadAllocations.bytes += bytes;
+}
+
+} // namespace detail
+
+/**
+ * @class AllocationScope
+ * @brief Counts the allocations made by the current thread between construction and stats(), e.g.
+ *        to assert that a call stays within a budget.
+ */
+class AllocationScope {
+public:
+    AllocationScope() noexcept : start_(detail::threadAllocations) {}
+
+    AllocationStats stats() const noexcept {
+        const AllocationStats now = detail::threadAllocations;
+        return {now.allocations - start_.allocations, now.bytes - start_.bytes};
+    }
+
+    /// True if allocations are actually being counted, i.e. the hooks are linked in.
+    static bool active() noexcept { return detail::allocationHooksInstalled.load(std::memory_order_relaxed); }
+
+private:
+    AllocationStats start_;
+};
+
+namespace detail {
+
+/**
+ * @class AllocationRegistry
+ * @brief Per-FileSystem allocation totals by operation. Profiling builds favour simplicity over
+ *        speed, so counters are shared atomics.
+ */
+class AllocationRegistry {
+public:
+    void record(Op op, const AllocationStats& call) noexcept {
+        Counters& c = ops_[static_cast<size_t>(op)];
+        c.calls.fetch_add(1, std::memory_order_relaxed);
+        c.allocations.fetch_add(call.allocations, std::memory_order_relaxed);
+        c.bytes.fetch_add(call.bytes, std::memory_order_relaxed);
+        raise(c.maxAllocations, call.allocations);
+        raise(c.maxBytes, call.bytes);
+    }
+
+    AllocationProfile snapshot() const {
+        AllocationProfile profile;
+        profile.enabled = AllocationScope::active();
+        for (size_t op = 0; op < kOpCount; ++op) {
+            const Counters& c = ops_[op];
+            const uint64_t calls = c.calls.load(std::memory_order_relaxed);
+            if (calls == 0) continue;
+            profile.ops.push_back({static_cast<Op>(op), calls, c.allocations.load(std::memory_order_relaxed),
+                                   c.bytes.load(std::memory_order_relaxed), c.maxAllocations.load(std::memory_order_relaxed),
+                                   c.maxBytes.load(std::memory_order_relaxed)});
+        }
+        return profile;
+    }
+
+private:
+    struct Counters {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> maxAllocations{0};
+        std::atomic<uint64_t> maxBytes{0};
+    };
+
+    static void raise(std::atomic<uint64_t>& max, uint64_t value) noexcept {
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::array<Counters, kOpCount> ops_;
+};
+
+/// Records the allocations made during one public FileSystem call, nested calls included.
+class AllocationOpScope {
+public:
+    AllocationOpScope(AllocationRegistry& registry, Op op) noexcept : registry_(registry), op_(op) {}
+    AllocationOpScope(const AllocationOpScope&) = delete;
+    AllocationOpScope& operator=(const AllocationOpScope&) = delete;
+    ~AllocationOpScope() { registry_.record(op_, scope_.stats()); }
+
+private:
+    AllocationRegistry& registry_;
+    Op op_;
+    AllocationScope scope_;
+};
+
+} // namespace detail
+
+#define EMFS_ALLOCATIONS_OP_(op) ::e_mfs::detail::AllocationOpScope emfsAllocationScope_(allocationRegistry, ::e_mfs::Op::op);
+#else
+#define EMFS_ALLOCATIONS_OP_(op)
+#endif
+
+// Instruments the enclosing public FileSystem method for tracing, metrics and allocation profiling,
+// each compiled in only when enabled; the remaining arguments are the path, the target of two-path
+// operations and the data written, if any. Innermost scopes are constructed last, so allocations made by the other
+// instruments are not counted.
+#define EMFS_OP(op, ...) EMFS_TRACE_OP_(op, __VA_ARGS__) EMFS_METRICS_OP_(op) EMFS_ALLOCATIONS_OP_(op) ((void)0)
+
+// --- Workload Recording ---
+/**
+ * @enum RecordContent
+ * @brief How a workload trace keeps the data given to writeFile and append.
+ */
+enum class RecordContent : uint8_t {
+    None, // Only the size; replay writes filler of that size
+    Hash, // Size and XXH64, so replay can regenerate identical data for identical writes
+    Full  // The data itself
+};
+
+/**
+ * @struct WorkloadRecord
+ * @brief One public operation in a workload trace.
+ * @details `thread` numbers the recording threads densely from 0. `start` is nanoseconds since the
+ *          recording began. Traces keep operations in completion order, so a reader that needs
+ *          start order must sort.
+ */
+struct WorkloadRecord {
+    Op op = Op::Count;
+    uint32_t thread = 0;
+    int64_t start = 0;
+    int64_t duration = 0;
+    std::string path;
+    std::string target; // Second path of cp, mv, link, symlink and retarget
+    uint64_t bytes = 0; // Written, read or copied
+    bool recursive = false; // Whether rm was recursive
+    bool failed = false;
+    std::optional<uint64_t> contentHash;
+    std::optional<std::string> content;
+};
+
+/**
+ * @class WorkloadWriter
+ * @brief Encodes WorkloadRecords as a compact binary trace.
+ * @details After an 8-byte magic and the content mode, each record is length-prefixed. Integers are
+ *          varints, start times are deltas from the previous record and the first 2^20 distinct
+ *          paths are spelled out once, then referred to by number; later ones are always spelled
+ *          out, which bounds the memory of writer and reader on traces of very large trees. Data
+ *          larger than kMaxContentBytes is kept as its hash only, so records stay below
+ *          kMaxRecordBytes, the most a reader accepts.
+ */
+class WorkloadWriter {
+public:
+    WorkloadWriter(std::ostream& out, RecordContent content) : out_(out), content_(content) {
+        buffer_.append(kMagic, 8);
+        buffer_.push_back(static_cast<char>(content));
+    }
+    WorkloadWriter(const WorkloadWriter&) = delete;
+    WorkloadWriter& operator=(const WorkloadWriter&) = delete;
+
+    ~WorkloadWriter() {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    RecordContent content() const { return content_; }
+
+    void write(const WorkloadRecord& record) {
+        scratch_.clear();
+        detail::BinaryWriter writer(scratch_);
+        const bool hashed = content_ != RecordContent::None && record.contentHash;
+        const bool full = content_ == RecordContent::Full && record.content && record.content->size() <= kMaxContentBytes;
+        writer.u8(static_cast<uint8_t>(record.op));
+        writer.u8(static_cast<uint8_t>((record.failed ? 1 : 0) | (hashed ? 2 : 0) | (full ? 4 : 0) |
+                                       (record.recursive ? 8 : 0)));
+        writer.varint(record.thread);
+        const int64_t delta = record.start - lastStart_;
+        writer.varint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63)); // Zigzag
+        lastStart_ = record.start;
+        writer.varint(static_cast<uint64_t>(std::max<int64_t>(record.duration, 0)));
+        _path(writer, record.path);
+        _path(writer, record.target);
+        writer.varint(record.bytes);
+        if (hashed) writer.u64(*record.contentHash);
+        if (full) writer.string(*record.content);
+        detail::BinaryWriter(buffer_).string(scratch_);
+        if (buffer_.size() >= kFlushBytes) flush();
+    }
+
+    void flush() {
+        if (buffer_.empty()) return;
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+        out_.flush();
+        if (!out_) throw FileSystemException("Failed to write workload trace.");
+    }
+
+    static constexpr char kMagic[] = "EMFSWKL2";
+    static constexpr size_t kMaxPaths = size_t(1) << 20;
+    static constexpr size_t kMaxContentBytes = size_t(1) << 28;
+    static constexpr uint64_t kMaxRecordBytes = uint64_t(1) << 30;
+
+private:
+    static constexpr size_t kFlushBytes = size_t(1) << 20;
+
+    void _path(detail::BinaryWriter& writer, const std::string& path) {
+        if (const auto it = paths_.find(path); it != paths_.end()) return writer.varint(it->second);
+        if (paths_.size() < kMaxPaths) paths_.emplace(path, paths_.size() + 1);
+        writer.varint(0);
+        writer.string(path);
+    }
+
+    std::ostream& out_;
+    RecordContent content_;
+    std::string buffer_;
+    std::string scratch_;
+    std::unordered_map<std::string, uint64_t> paths_; // Path -> number, from 1
+    int64_t lastStart_ = 0;
+};
+
+/**
+ * @class WorkloadReader
+ * @brief Decodes a trace written by WorkloadWriter one record at a time; throws
+ *        FileSystemException on malformed input.
+ */
+class WorkloadReader {
+public:
+    explicit WorkloadReader(std::istream& in) : in_(in) {
+        char header[9];
+        if (!in_.read(header, sizeof(header)) || std::memcmp(header, WorkloadWriter::kMagic, 8) != 0 ||
+            static_cast<uint8_t>(header[8]) > static_cast<uint8_t>(RecordContent::Full)) {
+            throw FileSystemException("Stream does not contain a workload trace.");
+        }
+        content_ = static_cast<RecordContent>(header[8]);
+    }
+
+    RecordContent content() const { return content_; }
+
+    /// Reads the next record into `record`; false at the end of the trace.
+    bool next(WorkloadRecord& record) {
+        uint64_t length = 0;
+        for (int shift = 0;; shift += 7) {
+            const int c = in_.get();
+            if (c == std::char_traits<char>::eof()) {
+                if (shift == 0) return false;
+                throw FileSystemException("Truncated workload trace.");
+            }
+            if (shift > 56) throw FileSystemException("Malformed workload trace.");
+            length |= uint64_t(c & 0x7F) << shift;
+            if (!(c & 0x80)) break;
+        }
+        if (length > WorkloadWriter::kMaxRecordBytes) throw FileSystemException("Malformed workload trace.");
+        detail::readExactly(in_, length, scratch_, "Truncated workload trace.");
+        detail::BinaryReader reader(scratch_);
+        const uint8_t op = reader.u8();
+        if (op >= kOpCount) throw FileSystemException("Unknown operation in workload trace.");
+        record.op = static_cast<Op>(op);
+        const uint8_t flags = reader.u8();
+        record.failed = flags & 1;
+        record.recursive = flags & 8;
+        record.thread = static_cast<uint32_t>(reader.varint());
+        const uint64_t zigzag = reader.varint();
+        lastStart_ += static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+        record.start = lastStart_;
+        record.duration = static_cast<int64_t>(reader.varint());
+        record.path.assign(_path(reader));
+        record.target.assign(_path(reader));
+        record.bytes = reader.varint();
+        record.contentHash.reset();
+        record.content.reset();
+        if (flags & 2) record.contentHash = reader.u64();
+        if (flags & 4) record.content = reader.string();
+        return true;
+    }
+
+private:
+    std::string_view _path(detail::BinaryReader& reader) {
+        const uint64_t id = reader.varint();
+        if (id == 0) {
+            const std::string_view path = reader.bytes();
+            if (paths_.size() < WorkloadWriter::kMaxPaths) paths_.emplace_back(path);
+            return path;
+        }
+        if (id > paths_.size()) throw FileSystemException("Malformed workload trace.");
+        return paths_[id - 1];
+    }
+
+    std::istream& in_;
+    RecordContent content_ = RecordContent::None;
+    std::vector<std::string> paths_;
+    std::string scratch_;
+    int64_t lastStart_ = 0;
+};
+
+/**
+ * @class WorkloadRecorder
+ * @brief A TraceSink that writes every public operation to a workload trace, for emfs-replay.
+ * @details Install it with FileSystem::setTraceSink() in a build with EMFS_ENABLE_TRACING. Only
+ *          outermost operations are recorded, since replaying one repeats the calls it makes.
+ *          Threads are serialized on one mutex while recording.
+ */
+class WorkloadRecorder : public TraceSink {
+public:
+    explicit WorkloadRecorder(std::ostream& out, RecordContent content = RecordContent::Hash)
+        : writer_(out, content), origin_(_now()) {}
+
+    void begin(const TraceEvent& event) override {
+        if (event.phase != TracePhase::Operation) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        _Thread& thread = _thread();
+        if (thread.depth++ > 0) return;
+        WorkloadRecord& record = thread.record;
+        record.op = event.op;
+        record.start = event.timestamp - origin_;
+        record.path.assign(event.path);
+        record.target.assign(event.target);
+        record.contentHash.reset();
+        record.content.reset();
+        if (event.op == Op::WriteFile || event.op == Op::Append) {
+            if (writer_.content() != RecordContent::None) {
+                record.contentHash = detail::xxh64(event.content.data(), event.content.size());
+            }
+            if (writer_.content() == RecordContent::Full) record.content.emplace(event.content);
+        }
+    }
+
+    void end(const TraceEvent& event) override {
+        if (event.phase != TracePhase::Operation) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        _Thread& thread = _thread();
+        if (thread.depth == 0 || --thread.depth > 0) return;
+        WorkloadRecord& record = thread.record;
+        record.duration = event.timestamp - origin_ - record.start;
+        record.bytes = event.bytes;
+        record.recursive = event.recursive;
+        record.failed = event.failed;
+        writer_.write(record);
+        ++recorded_;
+    }
+
+    /// Writes buffered records to the stream; the destructor does so too.
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        writer_.flush();
+    }
+
+    uint64_t recorded() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return recorded_;
+    }
+
+private:
+    struct _Thread {
+        WorkloadRecord record;
+        size_t depth = 0;
+    };
+
+    _Thread& _thread() {
+        const auto [it, added] = threads_.try_emplace(std::this_thread::get_id());
+        if (added) it->second.record.thread = static_cast<uint32_t>(threads_.size() - 1);
+        return it->second;
+    }
+
+    static int64_t _now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    mutable std::mutex mutex_;
+    WorkloadWriter writer_;
+    const int64_t origin_;
+    std::unordered_map<std::thread::id, _Thread> threads_;
+    uint64_t recorded_ = 0;
+};
+
+// --- Main File System Class ---
+/**
+ * @class FileSystem
+ * @brief Provides a shell-like API for managing an in-memory file system.
+ * @details Not internally synchronized: callers serialize mutations. Const methods may run
+ *          concurrently with each other, except those that fill the hash caches on nodes, which
+ *          need the same exclusive access as a mutation: checksum(), treeHash(), subtreeEquals(),
+ *          diff(), makeSyncDelta() and sync() (on both file systems).
+ */
+class FileSystem {
+private:
+    std::shared_ptr<DirectoryNode> root; // Root directory of the file system
+    std::unique_ptr<detail::SecondaryIndexes> indexes; // Present only after enableIndexes()
+    std::unique_ptr<detail::InvertedIndex> textIndex;  // Present only after enableFullTextIndex()
+    std::vector<std::shared_ptr<Watcher>> watchers;    // Registered watches
+    std::unique_ptr<detail::ChangeJournal> journal;    // Present only after enableJournal()
+    std::atomic<AtimePolicy> atimePolicy{AtimePolicy::Relaxed};
+    LinkAccounting linkAccounting = LinkAccounting::CountOnce;
+    size_t hardLinks = 0;                              // FileNode::extraLinks entries across the tree
+    uint64_t treeGeneration = 1;                       // Bumped by removals and retargets; see SymlinkNode::Resolution
+#ifdef EMFS_ENABLE_METRICS
+    mutable detail::MetricsRegistry metricsRegistry;   // Fed by EMFS_OP in every public operation
+#endif
+#ifdef EMFS_ENABLE_TRACING
+    std::shared_ptr<TraceSink> traceSink;              // Set by setTraceSink(); EMFS_OP is silent without one
+#endif
+#ifdef EMFS_ENABLE_ALLOCATION_PROFILING
+    mutable detail::AllocationRegistry allocationRegistry; // Fed by EMFS_OP in every public operation
+#endif
+
+    struct _TtlTimer {
+        std::weak_ptr<FSNode> node;
+        int64_t deadline; // Stale once the node's expiresAt no longer matches
+    };
+    std::unique_ptr<detail::TimerWheel<_TtlTimer>> ttlWheel; // Present only after the first setTtl()
+    std::unique_ptr<detail::Reclaimer> reclaimer;            // Started by the first expiry
+    std::atomic<uint32_t> heatSampleEvery{0};          // 0 while heat tracking is off
+    int64_t heatHalfLife = 1;                          // Nanoseconds
+    int64_t heatBase = 0;                              // Start of decay epoch 0; set once by the first enable
+
+    // --- Helper Methods ---
+    // Symlinks followed by one lookup before it fails, like Linux's MAXSYMLINKS.
+    static constexpr int kMaxSymlinkHops = 40;
+    // Resolution of the TTL timing wheel.
+    static constexpr int64_t kTtlTickNanos = 1000000;
+
+    enum class _WalkError : uint8_t { None, NotFound, NotDirectory, Loop };
+
+    // Resolves `path` from `start` (absolute paths restart at the root) without throwing or allocating;
+    // keys are looked up through a reused thread_local string, since the child map is keyed by
+    // std::string. Symlinks in intermediate components are always followed, the last one only if
+    // `followLast` or if a '/' trails it. `..` is physical: it leaves the directory a link led to.
+    const FSNode* _walk(const DirectoryNode* start, std::string_view path, bool followLast, int& hops,
+                        _WalkError& error) const noexcept {
+        thread_local std::string key;
+        const DirectoryNode* current = start;
+        size_t pos = 0;
+        if (!path.empty() && path[0] == '/') {
+            current = root.get();
+            pos = 1;
+        }
+        while (pos < path.size()) {
+            size_t end = path.find('/', pos);
+            if (end == std::string_view::npos) end = path.size();
+            const std::string_view component = path.substr(pos, end - pos);
+            pos = end + 1;
+            if (component.empty() || component == ".") continue;
+            if (component == "..") {
+                if (current != root.get()) current = current->parent.lock().get();
+                continue;
+            }
+            try {
+                key.assign(component.data(), component.size());
+            } catch (...) {
+                error = _WalkError::NotFound;
+                return nullptr;
+            }
+            auto it = current->children.find(key);
+            if (it == current->children.end()) {
+                error = _WalkError::NotFound;
+                return nullptr;
+            }
+            const FSNode* node = it->second.get();
+            const bool last = pos >= path.size(); // Only a trailing '/' may follow the last component
+            if (node->getType() == NodeType::Symlink && (!last || followLast || end < path.size())) {
+                if (_expired(*node)) {
+                    error = _WalkError::NotFound;
+                    return nullptr;
+                }
+                node = _follow(static_cast<const SymlinkNode&>(*node), current, hops, error);
+                if (!node) return nullptr;
+            }
+            if (_expired(*node)) { // Past its TTL but not yet swept: already gone for readers
+                error = _WalkError::NotFound;
+                return nullptr;
+            }
+            if (node->getType() == NodeType::Directory) {
+                current = static_cast<const DirectoryNode*>(node);
+            } else if (!last) {
+                error = _WalkError::NotDirectory;
+                return nullptr;
+            } else {
+                return node;
+            }
+        }
+        return current;
+    }
+
+    // Resolves a symlink found in `dir`, through its cached resolution when the tree has not lost an
+    // entry or retargeted a link since; a hot link then costs one hop instead of a walk of its target.
+    const FSNode* _follow(const SymlinkNode& link, const DirectoryNode* dir, int& hops, _WalkError& error) const noexcept {
+        if (++hops > kMaxSymlinkHops) {
+            error = _WalkError::Loop;
+            return nullptr;
+        }
+        auto& cache = link.resolution;
+        if (cache.generation.load(std::memory_order_acquire) == treeGeneration) {
+            hops += cache.hops.load(std::memory_order_relaxed);
+            if (hops <= kMaxSymlinkHops) return cache.node.load(std::memory_order_relaxed);
+            error = _WalkError::Loop;
+            return nullptr;
+        }
+        if (link.target.empty()) {
+            error = _WalkError::NotFound;
+            return nullptr;
+        }
+        const int before = hops;
+        const FSNode* target = _walk(dir, link.target, true, hops, error);
+        if (!target) return nullptr;
+        cache.node.store(target, std::memory_order_relaxed);
+        cache.hops.store(hops - before, std::memory_order_relaxed);
+        cache.generation.store(treeGeneration, std::memory_order_release);
+        return target;
+    }
+
+    std::shared_ptr<FSNode> _resolvePath(std::string_view path, bool followLast = true) const {
+        EMFS_TRACE_PHASE(Resolve, path);
+        if (path.empty()) {
+            throw FileSystemException("Path cannot be empty.");
+        }
+        int hops = 0;
+        _WalkError error = _WalkError::None;
+        const FSNode* node = _walk(root.get(), path, followLast, hops, error);
+        if (!node) {
+            if (error == _WalkError::Loop) {
+                throw FileSystemException("Too many levels of symbolic links: " + std::string(path));
+            }
+            if (error == _WalkError::NotDirectory) {
+                throw FileSystemException("Path component is not a directory: " + std::string(path));
+            }
+            throw FileSystemException("Path not found: " + std::string(path));
+        }
+        return std::const_pointer_cast<FSNode>(node->shared_from_this());
+    }
+
+    static std::shared_ptr<DirectoryNode> _asDirectory(const std::shared_ptr<FSNode>& node) {
+        return std::static_pointer_cast<DirectoryNode>(node);
+    }
+
+    // Directory entry named by `path`, which is not followed if it is a symlink. Unlike node->name
+    // this tells the hard links of a file apart.
+    std::pair<std::shared_ptr<DirectoryNode>, std::string> _resolveEntry(std::string_view path) const {
+        auto node = _resolvePath(path, false);
+        if (node->getType() == NodeType::Directory) return {node->parent.lock(), node->name};
+        while (path.size() > 1 && path.back() == '/') path.remove_suffix(1);
+        const size_t slash = path.find_last_of('/');
+        if (slash == std::string_view::npos) return {root, std::string(path)};
+        auto parent = _resolvePath(slash == 0 ? std::string_view("/") : path.substr(0, slash));
+        return {_asDirectory(parent), std::string(path.substr(slash + 1))};
+    }
+
+    // Non-throwing, allocation-free counterpart of _resolvePath for read-only queries; nullptr if absent.
+    const FSNode* _lookup(std::string_view path, bool followLast = true) const noexcept {
+        EMFS_TRACE_PHASE(Resolve, path);
+        if (path.empty()) return nullptr;
+        int hops = 0;
+        _WalkError error = _WalkError::None;
+        return _walk(root.get(), path, followLast, hops, error);
+    }
+
+    // _lookup, falling back to _resolvePath to raise its descriptive error.
+    const FSNode& _node(std::string_view path, bool followLast = true) const {
+        if (const FSNode* node = _lookup(path, followLast)) return *node;
+        return *_resolvePath(path, followLast);
+    }
+
+    static NodeStat _stat(const FSNode& node) {
+        NodeStat st;
+        st.type = node.getType();
+        st.size = node.size();
+        st.childCount = st.type == NodeType::Directory ? static_cast<const DirectoryNode&>(node).children.size() : 0;
+        st.nlink = st.type == NodeType::File ? static_cast<const FileNode&>(node).nlink : 1;
+        st.mode = node.meta.mode;
+        st.uid = node.meta.uid;
+        st.gid = node.meta.gid;
+        st.mtime = node.meta.mtime;
+        st.ctime = node.meta.ctime;
+        st.atime = node.meta.atime.load(std::memory_order_relaxed);
+        st.version = node.meta.version;
+        st.expiresAt = node.expiresAt;
+        return st;
+    }
+
+    std::pair<std::shared_ptr<DirectoryNode>, std::string> _resolveParentAndName(std::string_view path) const {
+        if (path.empty() || path == "/") {
+            throw FileSystemException("Invalid path for child creation: " + std::string(path));
+        }
+        size_t last_slash = path.find_last_of('/');
+        if (last_slash == std::string::npos) { // e.g., "file.txt"
+            throw FileSystemException("Paths must be absolute (start with '/'): " + std::string(path));
+        }
+        
+        std::string_view parentPath_sv = (last_slash == 0) ? "/" : path.substr(0, last_slash);
+        std::string_view childName_sv = path.substr(last_slash + 1);
+        
+        if (childName_sv.empty()) {
+            throw FileSystemException("Path cannot end with a slash for this operation: " + std::string(path));
+        }
+
+        auto parentNode = _resolvePath(parentPath_sv);
+        if (parentNode->getType() != NodeType::Directory) {
+            throw FileSystemException("Parent path is not a directory: " + std::string(parentPath_sv));
+        }
+        return {std::static_pointer_cast<DirectoryNode>(parentNode), std::string(childName_sv)};
+    }
+    
+    // Improved helper to handle destinations like `cp file /dir/`
+    std::pair<std::shared_ptr<DirectoryNode>, std::string> _resolveDestination(std::string_view dest_path, const std::string& source_name) const {
+        try {
+            auto dest_node = _resolvePath(dest_path);
+            if (dest_node->getType() == NodeType::Directory) {
+                // Destination is an existing directory, so the final name is the source name.
+                auto dest_dir = std::static_pointer_cast<DirectoryNode>(dest_node);
+                if (dest_dir->children.count(source_name)) {
+                     throw FileSystemException("Destination '" + std::string(dest_path) + "/" + source_name + "' already exists.");
+                }
+                return {dest_dir, source_name};
+            } else {
+                // Destination exists and is a file.
+                throw FileSystemException("Destination file already exists: " + std::string(dest_path));
+            }
+        } catch (const FileSystemException&) {
+            // Destination path does not fully exist, resolve its parent.
+            return _resolveParentAndName(dest_path);
+        }
+    }
+
+
+    // --- Tree Structure ---
+    // All insertions into and removals from `children` go through these helpers:
+    // _link attaches a new node (or a new hard link to a file), _unlink disposes of one and _move
+    // re-parents an existing one. A file's primary link lives in FSNode::parent/name and any
+    // further ones in FileNode::extraLinks, so paths are taken from the entry, not node->name.
+    using ChildIterator = std::unordered_map<std::string, std::shared_ptr<FSNode>>::iterator;
+
+    void _link(const std::shared_ptr<DirectoryNode>& parent, const std::string& name, std::shared_ptr<FSNode> node) {
+        _attach(parent, name, node);
+        if (node->getType() == NodeType::File && static_cast<const FileNode&>(*node).nlink == 1) {
+            if (indexes) indexes->insert(static_cast<const FileNode&>(*node));
+            if (textIndex) textIndex->index(static_cast<const FileNode&>(*node));
+        }
+        if (!watchers.empty()) _notify(WatchCreate, *node, _entryPath(*parent, name));
+    }
+
+    void _unlink(const std::shared_ptr<DirectoryNode>& parent, ChildIterator it) {
+        const std::string path = watchers.empty() ? std::string() : _entryPath(*parent, it->first);
+        auto node = _detach(parent, it);
+        if (indexes || textIndex || hardLinks) _releaseSubtree(*node);
+        if (!watchers.empty()) _notify(WatchDelete, *node, path);
+        EMFS_TRACE_PHASE(Destroy, node->name, node->size());
+        node.reset(); // Frees the subtree unless it is still linked or referenced elsewhere
+    }
+
+    void _move(const std::shared_ptr<DirectoryNode>& oldParent, ChildIterator it,
+               const std::shared_ptr<DirectoryNode>& newParent, const std::string& newName) {
+        const std::string oldPath = watchers.empty() ? std::string() : _entryPath(*oldParent, it->first);
+        auto node = _detach(oldParent, it);
+        const std::string indexedName = node->name;
+        _attach(newParent, newName, node);
+        node->meta.changed(newParent->meta.ctime); // A rename changes ctime, like on Linux
+        if (indexes && node->getType() == NodeType::File && node->name != indexedName) {
+            indexes->rename(static_cast<const FileNode&>(*node), indexedName);
+        }
+        if (!watchers.empty()) _notify(WatchMove, *node, _entryPath(*newParent, newName), oldPath);
+    }
+
+    static std::string _entryPath(const DirectoryNode& parent, const std::string& name) {
+        const std::string base = _pathOf(parent);
+        return (base == "/" ? std::string() : base) + "/" + name;
+    }
+
+    static bool _isPrimaryLink(const FSNode& node, const DirectoryNode& parent, const std::string& name) {
+        return node.name == name && node.parent.lock().get() == &parent;
+    }
+
+    // Bytes a directory entry contributes to its ancestors' sizes under the link accounting mode.
+    size_t _entryBytes(const FSNode& node, bool primary) const {
+        if (node.getType() == NodeType::Symlink) return 0;
+        return primary || linkAccounting == LinkAccounting::CountEach ? node.size() : 0;
+    }
+
+    // Removes the entry (dir, name) from a file's links; if it was the primary one, another link is
+    // promoted. Returns whether the dropped entry was the primary link.
+    bool _dropLink(FileNode& file, const DirectoryNode& dir, const std::string& name) {
+        --file.nlink;
+        if (!_isPrimaryLink(file, dir, name)) {
+            auto& links = file.extraLinks;
+            links.erase(std::find_if(links.begin(), links.end(), [&](const FileNode::Link& link) {
+                return link.name == name && link.parent.lock().get() == &dir;
+            }));
+            --hardLinks;
+            return false;
+        }
+        if (file.extraLinks.empty()) {
+            file.parent.reset();
+            return true;
+        }
+        FileNode::Link next = std::move(file.extraLinks.back());
+        file.extraLinks.pop_back();
+        --hardLinks;
+        const std::string oldName = std::move(file.name);
+        file.parent = next.parent;
+        file.name = std::move(next.name);
+        if (linkAccounting == LinkAccounting::CountOnce) _growSize(file.parent.lock().get(), file.size());
+        if (indexes) indexes->rename(file, oldName);
+        return true;
+    }
+
+    // Recomputes every directory size, e.g. after the link accounting mode changed.
+    size_t _recomputeSize(DirectoryNode& dir) const {
+        size_t total = 0;
+        for (const auto& [name, child] : dir.children) {
+            total += child->getType() == NodeType::Directory ? _recomputeSize(static_cast<DirectoryNode&>(*child))
+                                                              : _entryBytes(*child, _isPrimaryLink(*child, dir, name));
+        }
+        return dir.totalSize = total;
+    }
+
+    // Checks the subtree below `dir` and returns the bytes it should account for; `links` counts the
+    // entries seen for every file, `visited` guards against directory cycles.
+    size_t _verify(const std::shared_ptr<DirectoryNode>& dir, const std::string& path, VerifyReport& report,
+                   std::unordered_map<const FileNode*, uint32_t>& links,
+                   std::unordered_set<const DirectoryNode*>& visited) const {
+        ++report.directories;
+        if (!visited.insert(dir.get()).second) {
+            report.errors.push_back(path + ": directory reachable twice");
+            return 0;
+        }
+        const std::string prefix = path == "/" ? path : path + "/";
+        size_t total = 0;
+        for (const auto& [name, child] : dir->children) {
+            const std::string childPath = prefix + name;
+            if (!child) {
+                report.errors.push_back(childPath + ": null entry");
+                continue;
+            }
+            if (name.empty() || name.find('/') != std::string::npos || name == "." || name == "..") {
+                report.errors.push_back(childPath + ": invalid entry name");
+            }
+            if (child->getType() == NodeType::File) {
+                const auto& file = static_cast<const FileNode&>(*child);
+                ++links[&file];
+                const bool primary = _isPrimaryLink(file, *dir, name);
+                const bool extra = std::any_of(file.extraLinks.begin(), file.extraLinks.end(), [&](const FileNode::Link& link) {
+                    return link.name == name && link.parent.lock() == dir;
+                });
+                if (primary == extra) {
+                    report.errors.push_back(childPath + (primary ? ": entry recorded twice among the file's links"
+                                                                 : ": entry missing from the file's links"));
+                }
+                total += _entryBytes(file, primary);
+                continue;
+            }
+            if (child->parent.lock() != dir) report.errors.push_back(childPath + ": parent pointer does not match");
+            if (child->name != name) report.errors.push_back(childPath + ": node name is '" + child->name + "'");
+            if (child->getType() == NodeType::Symlink) {
+                ++report.symlinks;
+                continue;
+            }
+            total += _verify(_asDirectory(child), childPath, report, links, visited);
+        }
+        if (dir->totalSize != total) {
+            report.errors.push_back(path + ": size is " + std::to_string(dir->totalSize) + ", entries hold " +
+                                    std::to_string(total));
+        }
+        return total;
+    }
+
+    // --- Snapshots ---
+    // Files with several hard links are written once ('H') and referenced by their index afterwards ('L').
+    static void _encodeNode(const std::string& name, const FSNode& node, detail::BinaryWriter& writer,
+                            std::unordered_map<const FileNode*, uint64_t>& linked) {
+        writer.string(name);
+        writer.varint(node.meta.mode);
+        writer.varint(node.meta.uid);
+        writer.varint(node.meta.gid);
+        writer.u64(static_cast<uint64_t>(node.meta.mtime));
+        writer.u64(static_cast<uint64_t>(node.meta.ctime));
+        writer.u64(static_cast<uint64_t>(node.meta.atime.load(std::memory_order_relaxed)));
+        writer.u64(static_cast<uint64_t>(node.expiresAt));
+        writer.varint(node.xattrs ? node.xattrs->size() : 0);
+        if (node.xattrs) {
+            node.xattrs->forEach([&](const std::string& key, const std::string& value) {
+                writer.string(key);
+                writer.string(value);
+            });
+        }
+        if (node.getType() == NodeType::Symlink) {
+            writer.u8('S');
+            writer.string(static_cast<const SymlinkNode&>(node).target);
+            return;
+        }
+        if (node.getType() == NodeType::File) {
+            const auto& file = static_cast<const FileNode&>(node);
+            if (file.nlink > 1) {
+                const auto [it, first] = linked.try_emplace(&file, linked.size());
+                if (!first) {
+                    writer.u8('L');
+                    writer.varint(it->second);
+                    return;
+                }
+            }
+            writer.u8(file.nlink > 1 ? 'H' : 'F');
+            writer.bytes(file.content.data(), file.content.size());
+            return;
+        }
+        const auto& dir = static_cast<const DirectoryNode&>(node);
+        writer.u8('D');
+        // Entries past their TTL are already gone for readers, so they are left out.
+        writer.varint(std::count_if(dir.children.begin(), dir.children.end(),
+                                    [](const auto& entry) { return !_expired(*entry.second); }));
+        for (const auto& [childName, child] : dir.children) {
+            if (!_expired(*child)) _encodeNode(childName, *child, writer, linked);
+        }
+    }
+
+    static NodeMetadata _decodeMetadata(detail::BinaryReader& reader) {
+        NodeMetadata meta(static_cast<uint16_t>(reader.varint() & 07777), 0);
+        meta.uid = static_cast<uint32_t>(reader.varint());
+        meta.gid = static_cast<uint32_t>(reader.varint());
+        meta.mtime = static_cast<int64_t>(reader.u64());
+        meta.ctime = static_cast<int64_t>(reader.u64());
+        meta.atime.store(static_cast<int64_t>(reader.u64()), std::memory_order_relaxed);
+        return meta;
+    }
+
+    static std::unique_ptr<detail::XattrMap> _decodeXattrs(detail::BinaryReader& reader) {
+        std::unique_ptr<detail::XattrMap> xattrs;
+        for (uint64_t count = reader.varint(); count > 0; --count) {
+            const std::string_view name = reader.bytes();
+            const std::string_view value = reader.bytes();
+            if (!xattrs) xattrs = std::make_unique<detail::XattrMap>();
+            xattrs->set(name, value);
+        }
+        return xattrs;
+    }
+
+    void _decodeChildren(const std::shared_ptr<DirectoryNode>& dir, detail::BinaryReader& reader,
+                         std::vector<std::shared_ptr<FileNode>>& linked, bool keepTtls) {
+        for (uint64_t count = reader.varint(); count > 0; --count) {
+            std::string name = reader.string();
+            NodeMetadata meta = _decodeMetadata(reader);
+            const int64_t saved = static_cast<int64_t>(reader.u64());
+            const int64_t expiresAt = keepTtls ? saved : 0;
+            std::unique_ptr<detail::XattrMap> xattrs = _decodeXattrs(reader);
+            if (name.empty() || name.find('/') != std::string::npos || name == "." || name == ".." ||
+                dir->children.count(name)) {
+                throw FileSystemException("Invalid entry name in snapshot: " + name);
+            }
+            const uint8_t type = reader.u8();
+            if (type == 'F' || type == 'H') {
+                auto file = std::make_shared<FileNode>(name, dir);
+                const std::string_view content = reader.bytes();
+                file->content.assign(content.begin(), content.end());
+                file->meta = meta;
+                file->expiresAt = expiresAt;
+                file->xattrs = std::move(xattrs);
+                if (type == 'H') linked.push_back(file);
+                _link(dir, name, file);
+            } else if (type == 'S') {
+                auto link = std::make_shared<SymlinkNode>(name, dir, reader.string());
+                link->meta = meta;
+                link->expiresAt = expiresAt;
+                link->xattrs = std::move(xattrs);
+                _link(dir, name, link);
+            } else if (type == 'L') {
+                const uint64_t index = reader.varint();
+                if (index >= linked.size()) throw FileSystemException("Invalid hard link in snapshot.");
+                _link(dir, name, linked[index]);
+            } else if (type == 'D') {
+                auto child = std::make_shared<DirectoryNode>(name, dir);
+                child->expiresAt = expiresAt;
+                child->xattrs = std::move(xattrs);
+                _link(dir, name, child);
+                _decodeChildren(child, reader, linked, keepTtls);
+                child->meta = meta; // After the children, whose insertion bumps mtime
+            } else {
+                throw FileSystemException("Unknown node type in snapshot.");
+            }
+        }
+    }
+
+    // Decodes into this (empty) file system; loadSnapshot() runs it on a staging instance.
+    void _decodeSnapshot(std::string_view payload, bool keepTtls) {
+        detail::BinaryReader reader(payload);
+        reader.string(); // Root name
+        const NodeMetadata rootMeta = _decodeMetadata(reader);
+        reader.u64(); // The root never has a TTL
+        std::unique_ptr<detail::XattrMap> rootXattrs = _decodeXattrs(reader);
+        if (reader.u8() != 'D') throw FileSystemException("Snapshot root is not a directory.");
+        std::vector<std::shared_ptr<FileNode>> linked;
+        _decodeChildren(root, reader, linked, keepTtls);
+        root->meta = rootMeta;
+        root->xattrs = std::move(rootXattrs);
+        if (!reader.atEnd()) throw FileSystemException("Trailing data after snapshot.");
+    }
+
+    // Replaces the tree with the one decoded into `staged`. The root node itself is kept, so entries
+    // pointing at the staging root are re-pointed while the new entries are registered.
+    void _adoptTree(FileSystem& staged) {
+        while (!root->children.empty()) _unlink(root, root->children.begin());
+        DirectoryNode& from = *staged.root;
+        root->children.swap(from.children);
+        root->totalSize = from.totalSize;
+        root->meta = from.meta;
+        root->xattrs = std::move(from.xattrs);
+        root->merklePending.reset();
+        root->merkleRebuild = true;
+        root->merkleDirty = true;
+        hardLinks = staged.hardLinks;
+        staged.hardLinks = 0;
+        ++treeGeneration;
+        _registerAdopted(root, from);
+    }
+
+    void _registerAdopted(const std::shared_ptr<DirectoryNode>& dir, const DirectoryNode& from) {
+        for (const auto& [name, child] : dir->children) {
+            if (child->parent.lock().get() == &from) child->parent = root;
+            const bool primary = _isPrimaryLink(*child, *dir, name);
+            if (child->getType() == NodeType::File) {
+                auto& file = static_cast<FileNode&>(*child);
+                for (auto& link : file.extraLinks) {
+                    if (link.parent.lock().get() == &from) link.parent = root;
+                }
+                if (primary) {
+                    if (indexes) indexes->insert(file);
+                    if (textIndex) textIndex->index(file);
+                }
+            }
+            if (primary && child->expiresAt) _scheduleTtl(child, child->expiresAt);
+            if (!watchers.empty()) _notify(WatchCreate, *child, _entryPath(*dir, name));
+            if (child->getType() == NodeType::Directory) _registerAdopted(_asDirectory(child), from);
+        }
+    }
+
+    // --- Change Journal ---
+    void _journal(JournalOp op, std::string_view path, std::string_view target = {}, bool recursive = false,
+                  std::shared_ptr<const std::vector<char>> data = nullptr, uint64_t argument = 0) {
+        JournalEntry entry;
+        entry.op = op;
+        entry.argument = argument;
+        entry.recursive = recursive;
+        entry.path = std::string(path);
+        entry.target = std::string(target);
+        entry.data = std::move(data);
+        journal->record(std::move(entry));
+    }
+
+    // Content buffers are mutated in place (append, in-place patches), so entries own a copy.
+    static std::shared_ptr<const std::vector<char>> _payload(const char* data, size_t n) {
+        return std::make_shared<const std::vector<char>>(data, data + n);
+    }
+
+    // --- Change Notification ---
+    std::shared_ptr<Watcher> _addWatcher(std::string_view path, bool recursive, uint32_t mask, size_t capacity,
+                                         Watcher::Callback callback) {
+        std::string normalized = _pathOf(*_resolvePath(path));
+        auto watcher = std::make_shared<Watcher>(std::move(normalized), recursive, mask, capacity, std::move(callback));
+        watchers.push_back(watcher);
+        return watcher;
+    }
+
+    // Notifies the path of every hard link of a node, so watches on any linking directory see the change.
+    void _notifyLinks(WatchMask type, const FSNode& node) const {
+        _notify(type, node, _pathOf(node));
+        if (node.getType() != NodeType::File) return;
+        for (const auto& link : static_cast<const FileNode&>(node).extraLinks) {
+            if (auto dir = link.parent.lock()) _notify(type, node, _entryPath(*dir, link.name));
+        }
+    }
+
+    void _notify(WatchMask type, const FSNode& node, const std::string& path, const std::string& oldPath = {}) const {
+        for (const auto& watcher : watchers) {
+            if (watcher->covers(path) || (!oldPath.empty() && watcher->covers(oldPath))) {
+                watcher->deliver({type, node.getType(), path, oldPath});
+            }
+        }
+    }
+
+    void _attach(const std::shared_ptr<DirectoryNode>& parent, const std::string& name, const std::shared_ptr<FSNode>& node) {
+        bool primary = true;
+        if (node->getType() == NodeType::File) {
+            auto& file = static_cast<FileNode&>(*node);
+            if (file.nlink++ > 0) { // Already linked elsewhere: this entry is an additional hard link
+                file.extraLinks.push_back({parent, name});
+                ++hardLinks;
+                primary = false;
+            }
+        }
+        if (primary) {
+            node->parent = parent;
+            node->name = name;
+        }
+        _merklePending(*parent, name, std::nullopt);
+        parent->children[name] = node;
+        parent->meta.modified(detail::nowNanos());
+        _growSize(parent.get(), _entryBytes(*node, primary));
+        _markMerkleDirty(*parent);
+    }
+
+    // Directory sizes are aggregated up the parent chain so size() never recurses.
+    static void _growSize(DirectoryNode* dir, size_t bytes) {
+        for (; dir && bytes; dir = dir->parent.lock().get()) dir->totalSize += bytes;
+    }
+
+    static void _shrinkSize(DirectoryNode* dir, size_t bytes) {
+        for (; dir && bytes; dir = dir->parent.lock().get()) dir->totalSize -= bytes;
+    }
+
+    std::shared_ptr<FSNode> _detach(const std::shared_ptr<DirectoryNode>& parent, ChildIterator it) {
+        auto node = std::move(it->second);
+        bool primary = true;
+        if (node->getType() == NodeType::File) {
+            primary = _dropLink(static_cast<FileNode&>(*node), *parent, it->first);
+        } else {
+            node->parent.reset();
+        }
+        _shrinkSize(parent.get(), _entryBytes(*node, primary));
+        ++treeGeneration; // Cached symlink resolutions may have passed through this entry
+        _merklePending(*parent, it->first, node->merkleHash);
+        parent->children.erase(it);
+        parent->meta.modified(detail::nowNanos());
+        _markMerkleDirty(*parent);
+        return node;
+    }
+
+    // --- Secondary Indexes ---
+    // Drops the links held by a detached subtree and unindexes every file that is no longer linked.
+    void _releaseSubtree(FSNode& node) {
+        if (node.getType() == NodeType::Symlink) return;
+        if (node.getType() == NodeType::File) {
+            const auto& file = static_cast<const FileNode&>(node);
+            if (file.nlink > 0) return; // Still reachable through another hard link
+            if (indexes) indexes->erase(file);
+            if (textIndex) textIndex->remove(file);
+            return;
+        }
+        auto& dir = static_cast<DirectoryNode&>(node);
+        for (const auto& [name, child] : dir.children) {
+            if (child->getType() == NodeType::File) _dropLink(static_cast<FileNode&>(*child), dir, name);
+            _releaseSubtree(*child);
+        }
+    }
+
+    template <typename Fn>
+    static void _forEachFile(const FSNode& node, Fn&& fn) {
+        if (node.getType() == NodeType::File) {
+            fn(static_cast<const FileNode&>(node));
+            return;
+        }
+        if (node.getType() == NodeType::Symlink) return;
+        for (const auto& [name, child] : static_cast<const DirectoryNode&>(node).children) _forEachFile(*child, fn);
+    }
+
+    // Absolute path of an attached node, rebuilt from the parent chain.
+    static std::string _pathOf(const FSNode& node) {
+        std::vector<const FSNode*> chain;
+        std::shared_ptr<DirectoryNode> keep; // Holds each parent alive while walking
+        for (const FSNode* current = &node; current;) {
+            chain.push_back(current);
+            keep = current->parent.lock();
+            current = keep.get();
+        }
+        if (chain.size() == 1) return "/";
+        std::string path;
+        for (auto it = chain.rbegin() + 1; it != chain.rend(); ++it) {
+            path += '/';
+            path += (*it)->name;
+        }
+        return path;
+    }
+
+    // --- Merkle Hashes ---
+    static void _merklePending(const DirectoryNode& dir, const std::string& name, std::optional<uint64_t> contributed) {
+        if (dir.merkleRebuild) return;
+        if (!dir.merklePending) {
+            dir.merklePending = std::make_unique<std::unordered_map<std::string, std::optional<uint64_t>>>();
+        }
+        // Keep the first recorded value: it is the one actually included in merkleSum.
+        dir.merklePending->try_emplace(name, contributed);
+    }
+
+    // Marks a node and its ancestors dirty; stops at the first already-dirty ancestor, so the cost
+    // is O(depth) at most and O(1) when hashes are never requested.
+    static void _markMerkleDirty(const FSNode& start) {
+        if (!start.merkleDirty && start.getType() == NodeType::File) {
+            for (const auto& link : static_cast<const FileNode&>(start).extraLinks) {
+                auto dir = link.parent.lock();
+                if (!dir) continue;
+                _merklePending(*dir, link.name, start.merkleHash);
+                _markMerkleDirty(*dir);
+            }
+        }
+        for (const FSNode* node = &start; node && !node->merkleDirty;) {
+            node->merkleDirty = true;
+            auto parent = node->parent.lock();
+            if (!parent) break;
+            _merklePending(*parent, node->name, node->merkleHash);
+            node = parent.get();
+        }
+    }
+
+    static uint64_t _merkleEntry(const std::string& name, uint64_t childHash) {
+        return detail::xxh64(name.data(), name.size(), childHash);
+    }
+
+    static uint64_t _merkleHash(const FSNode& node) {
+        if (!node.merkleDirty) return node.merkleHash;
+        if (node.getType() == NodeType::File) {
+            const uint64_t contentHash = _checksum(static_cast<const FileNode&>(node), ChecksumAlgorithm::XXH64);
+            node.merkleHash = detail::xxh64("F", 1, contentHash);
+        } else if (node.getType() == NodeType::Symlink) {
+            const auto& target = static_cast<const SymlinkNode&>(node).target;
+            node.merkleHash = detail::xxh64("S", 1, detail::xxh64(target.data(), target.size(), 0));
+        } else {
+            const auto& dir = static_cast<const DirectoryNode&>(node);
+            if (dir.merkleRebuild) {
+                dir.merkleSum = 0;
+                for (const auto& [name, child] : dir.children) dir.merkleSum += _merkleEntry(name, _merkleHash(*child));
+                dir.merkleRebuild = false;
+            } else if (dir.merklePending) {
+                // Only children recorded as changed are rehashed.
+                for (const auto& [name, contributed] : *dir.merklePending) {
+                    if (contributed) dir.merkleSum -= _merkleEntry(name, *contributed);
+                    auto it = dir.children.find(name);
+                    if (it != dir.children.end()) dir.merkleSum += _merkleEntry(name, _merkleHash(*it->second));
+                }
+            }
+            dir.merklePending.reset();
+            const uint64_t count = dir.children.size();
+            node.merkleHash = detail::xxh64(reinterpret_cast<const char*>(&count), sizeof(count), dir.merkleSum);
+        }
+        node.merkleDirty = false;
+        return node.merkleHash;
+    }
+
+    // --- Tree Diff ---
+    struct _DiffSide {
+        std::string path;
+        std::shared_ptr<FSNode> node;
+    };
+
+    // Walks two directories in step, skipping any pair whose node identity or Merkle hash matches.
+    static void _diffDirectories(const DirectoryNode& a, const DirectoryNode& b, const std::string& rel,
+                                 std::vector<DiffEntry>& out, std::vector<_DiffSide>& removed,
+                                 std::vector<_DiffSide>& added) {
+        const std::string prefix = rel == "/" ? rel : rel + "/";
+        for (const auto& [name, childA] : a.children) {
+            if (_expired(*childA)) continue;
+            auto it = b.children.find(name);
+            if (it == b.children.end() || _expired(*it->second)) {
+                removed.push_back({prefix + name, childA});
+                continue;
+            }
+            const auto& childB = it->second;
+            if (childA == childB || _merkleHash(*childA) == _merkleHash(*childB)) continue;
+            if (childA->getType() != childB->getType()) {
+                removed.push_back({prefix + name, childA});
+                added.push_back({prefix + name, childB});
+            } else if (childA->getType() != NodeType::Directory) {
+                out.push_back({DiffKind::Modified, childA->getType(), prefix + name, {}});
+            } else {
+                _diffDirectories(static_cast<const DirectoryNode&>(*childA), static_cast<const DirectoryNode&>(*childB),
+                                 prefix + name, out, removed, added);
+            }
+        }
+        for (const auto& [name, childB] : b.children) {
+            if (_expired(*childB)) continue;
+            auto it = a.children.find(name);
+            if (it == a.children.end() || _expired(*it->second)) added.push_back({prefix + name, childB});
+        }
+    }
+
+    // --- Delta Sync ---
+    static std::string _joinPath(const std::string& base, std::string_view rel) {
+        if (rel == "/") return base;
+        return (base == "/" ? std::string() : base) + std::string(rel);
+    }
+
+    // Emits ops that recreate `node` from scratch at `rel`.
+    static void _deltaCreate(const FSNode& node, const std::string& rel, SyncDelta& delta) {
+        if (node.getType() == NodeType::File) {
+            const auto& content = static_cast<const FileNode&>(node).content;
+            delta.ops.push_back({SyncDelta::OpType::WriteFile, rel, std::string(content.begin(), content.end()), {}});
+            return;
+        }
+        if (node.getType() == NodeType::Symlink) {
+            delta.ops.push_back({SyncDelta::OpType::MakeSymlink, rel, static_cast<const SymlinkNode&>(node).target, {}});
+            return;
+        }
+        delta.ops.push_back({SyncDelta::OpType::MakeDir, rel, {}, {}});
+        const std::string prefix = rel == "/" ? rel : rel + "/";
+        for (const auto& [name, child] : static_cast<const DirectoryNode&>(node).children) {
+            if (!_expired(*child)) _deltaCreate(*child, prefix + name, delta);
+        }
+    }
+
+    // rsync block matching: index the basis by weak checksum, roll a window over the new content and
+    // emit block references where both weak and strong checksums agree.
+    static std::vector<SyncDelta::Chunk> _deltaPatch(const std::vector<char>& basis, const std::vector<char>& target,
+                                                      size_t blockSize) {
+        std::unordered_multimap<uint32_t, uint64_t> blocksByWeak;
+        std::vector<uint64_t> strong(basis.size() / blockSize);
+        detail::RollingChecksum rolling;
+        for (uint64_t i = 0; i < strong.size(); ++i) {
+            const char* block = basis.data() + i * blockSize;
+            rolling.reset(block, blockSize);
+            blocksByWeak.emplace(rolling.value(), i);
+            strong[i] = detail::xxh64(block, blockSize);
+        }
+
+        std::vector<SyncDelta::Chunk> chunks;
+        auto addLiteral = [&](const char* begin, const char* end) {
+            if (begin == end) return;
+            if (chunks.empty() || chunks.back().blockCount) chunks.emplace_back();
+            chunks.back().literal.append(begin, end);
+        };
+        auto addBlock = [&](uint64_t block) {
+            if (!chunks.empty() && chunks.back().blockCount &&
+                chunks.back().firstBlock + chunks.back().blockCount == block) {
+                ++chunks.back().blockCount;
+            } else {
+                chunks.push_back({block, 1, {}});
+            }
+        };
+
+        const char* data = target.data();
+        const size_t n = target.size();
+        size_t literalStart = 0;
+        size_t pos = 0;
+        bool windowValid = false;
+        while (!strong.empty() && pos + blockSize <= n) {
+            if (!windowValid) {
+                rolling.reset(data + pos, blockSize);
+                windowValid = true;
+            }
+            bool matched = false;
+            auto range = blocksByWeak.equal_range(rolling.value());
+            if (range.first != range.second) {
+                const uint64_t hash = detail::xxh64(data + pos, blockSize);
+                // Prefer the block that keeps runs contiguous.
+                uint64_t best = UINT64_MAX;
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (strong[it->second] != hash) continue;
+                    if (best == UINT64_MAX || it->second == (chunks.empty() ? 0 : chunks.back().firstBlock + chunks.back().blockCount)) {
+                        best = it->second;
+                    }
+                }
+                if (best != UINT64_MAX) {
+                    addLiteral(data + literalStart, data + pos);
+                    addBlock(best);
+                    pos += blockSize;
+                    literalStart = pos;
+                    windowValid = false;
+                    matched = true;
+                }
+            }
+            if (!matched) {
+                if (pos + blockSize < n) rolling.roll(data[pos], data[pos + blockSize]);
+                ++pos;
+            }
+        }
+        addLiteral(data + literalStart, data + n);
+        return chunks;
+    }
+
+    static void _deltaFile(const FileNode& src, const FileNode& dst, const std::string& rel, const SyncOptions& options,
+                           SyncDelta& delta) {
+        if (dst.content.size() < options.blockSize) {
+            _deltaCreate(src, rel, delta); // No complete block to reuse
+            return;
+        }
+        delta.ops.push_back({SyncDelta::OpType::PatchFile, rel, {}, _deltaPatch(dst.content, src.content, options.blockSize)});
+    }
+
+    static void _deltaDirectories(const DirectoryNode& src, const DirectoryNode& dst, const std::string& rel,
+                                  const SyncOptions& options, SyncDelta& delta) {
+        const std::string prefix = rel == "/" ? rel : rel + "/";
+        for (const auto& [name, srcChild] : src.children) {
+            if (_expired(*srcChild)) continue;
+            const std::string childRel = prefix + name;
+            auto it = dst.children.find(name);
+            if (it == dst.children.end() || _expired(*it->second)) {
+                _deltaCreate(*srcChild, childRel, delta);
+                continue;
+            }
+            const auto& dstChild = it->second;
+            if (srcChild == dstChild || _merkleHash(*srcChild) == _merkleHash(*dstChild)) continue;
+            if (srcChild->getType() != dstChild->getType() || srcChild->getType() == NodeType::Symlink) {
+                delta.ops.push_back({SyncDelta::OpType::Remove, childRel, {}, {}});
+                _deltaCreate(*srcChild, childRel, delta);
+            } else if (srcChild->getType() == NodeType::File) {
+                _deltaFile(static_cast<const FileNode&>(*srcChild), static_cast<const FileNode&>(*dstChild), childRel,
+                           options, delta);
+            } else {
+                _deltaDirectories(static_cast<const DirectoryNode&>(*srcChild),
+                                  static_cast<const DirectoryNode&>(*dstChild), childRel, options, delta);
+            }
+        }
+        if (!options.deleteExtraneous) return;
+        for (const auto& [name, dstChild] : dst.children) {
+            auto it = src.children.find(name);
+            if (it == src.children.end() || _expired(*it->second)) {
+                delta.ops.push_back({SyncDelta::OpType::Remove, prefix + name, {}, {}});
+            }
+        }
+    }
+
+    // Rebuilds a file from basis blocks and literals. When every block stays at its own offset the
+    // buffer is patched in place, so only changed blocks are rewritten.
+    void _applyPatch(const std::shared_ptr<FileNode>& file, const SyncDelta& delta, const SyncDelta::Op& op,
+                     SyncStats& stats) {
+        const uint64_t blockSize = delta.blockSize;
+        const auto& basis = file->content;
+        const size_t oldSize = basis.size();
+        const uint64_t basisBlocks = blockSize ? basis.size() / blockSize : 0;
+        bool inPlace = true;
+        uint64_t offset = 0;
+        for (const auto& chunk : op.chunks) {
+            // Checked without forming firstBlock + blockCount, which a malformed delta can overflow.
+            // Once both lie within the basis, their products with blockSize are at most its size.
+            if (chunk.blockCount &&
+                (chunk.firstBlock > basisBlocks || chunk.blockCount > basisBlocks - chunk.firstBlock)) {
+                throw FileSystemException("Sync delta references a missing block in: " + op.path);
+            }
+            const uint64_t bytes = chunk.blockCount ? chunk.blockCount * blockSize : chunk.literal.size();
+            if (bytes > std::numeric_limits<size_t>::max() - offset) {
+                throw FileSystemException("Sync delta result is too large for: " + op.path);
+            }
+            if (chunk.blockCount && chunk.firstBlock * blockSize != offset) inPlace = false;
+            offset += bytes;
+        }
+
+        if (inPlace) {
+            // Blocks already sit at their final offsets; a literal only overwrites bytes that no
+            // later (in-place) block references.
+            file->content.resize(offset);
+            uint64_t out = 0;
+            for (const auto& chunk : op.chunks) {
+                if (chunk.blockCount) {
+                    out += chunk.blockCount * blockSize;
+                    stats.matchedBytes += chunk.blockCount * blockSize;
+                } else {
+                    std::memcpy(file->content.data() + out, chunk.literal.data(), chunk.literal.size());
+                    out += chunk.literal.size();
+                    stats.literalBytes += chunk.literal.size();
+                }
+            }
+        } else {
+            std::vector<char> result;
+            result.reserve(offset);
+            for (const auto& chunk : op.chunks) {
+                if (chunk.blockCount) {
+                    const char* begin = basis.data() + chunk.firstBlock * blockSize;
+                    result.insert(result.end(), begin, begin + chunk.blockCount * blockSize);
+                    stats.matchedBytes += chunk.blockCount * blockSize;
+                } else {
+                    result.insert(result.end(), chunk.literal.begin(), chunk.literal.end());
+                    stats.literalBytes += chunk.literal.size();
+                }
+            }
+            file->content.swap(result);
+        }
+        _contentChanged(file, oldSize);
+    }
+
+    // --- Node Metadata ---
+    void _touch(FileNode& file) {
+        const int64_t oldMtime = file.meta.mtime;
+        const int64_t now = detail::nowNanos();
+        file.meta.modified(now);
+        file.meta.atime.store(now, std::memory_order_relaxed);
+        if (indexes) indexes->update(file, file.content.size(), oldMtime);
+        if (!watchers.empty()) _notifyLinks(WatchAttrib, file);
+    }
+
+    void _attributesChanged(FSNode& node) {
+        node.meta.changed(detail::nowNanos());
+        if (!watchers.empty()) _notifyLinks(WatchAttrib, node);
+    }
+
+    // --- Extended Attributes ---
+    static FSNode& _handleNode(const NodeHandle& handle) {
+        if (!handle) throw FileSystemException("Invalid node handle.");
+        return *handle.node_;
+    }
+
+    // Whether the node is still reachable from the root, i.e. not removed since it was opened.
+    bool _isAttached(const FSNode& node) const {
+        const FSNode* current = &node;
+        std::shared_ptr<DirectoryNode> keep; // Holds each parent alive while walking
+        while ((keep = current->parent.lock())) current = keep.get();
+        return current == root.get();
+    }
+
+    static std::optional<std::string> _getxattr(const FSNode& node, std::string_view name) {
+        const std::string* value = node.xattrs ? node.xattrs->find(name) : nullptr;
+        return value ? std::optional<std::string>(*value) : std::nullopt;
+    }
+
+    static void _setxattr(FSNode& node, std::string_view name, std::string_view value, XattrMode mode) {
+        if (name.empty() || name.size() > kMaxXattrNameLength) {
+            throw FileSystemException("Invalid attribute name: " + std::string(name));
+        }
+        if (value.size() > kMaxXattrValueSize) {
+            throw FileSystemException("Attribute value too large: " + std::string(name));
+        }
+        if (mode != XattrMode::Upsert) {
+            const bool exists = node.xattrs && node.xattrs->find(name);
+            if (mode == XattrMode::Create && exists) {
+                throw FileSystemException("Attribute already exists: " + std::string(name));
+            }
+            if (mode == XattrMode::Replace && !exists) {
+                throw FileSystemException("Attribute not found: " + std::string(name));
+            }
+        }
+        if (!node.xattrs) node.xattrs = std::make_unique<detail::XattrMap>();
+        node.xattrs->set(name, value);
+    }
+
+    static bool _removexattr(FSNode& node, std::string_view name) {
+        if (!node.xattrs || !node.xattrs->erase(name)) return false;
+        if (node.xattrs->empty()) node.xattrs.reset();
+        return true;
+    }
+
+    static std::vector<std::string> _listxattr(const FSNode& node) {
+        std::vector<std::string> names;
+        if (!node.xattrs) return names;
+        names.reserve(node.xattrs->size());
+        node.xattrs->forEach([&](const std::string& name, const std::string&) { names.push_back(name); });
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    // Publishes an attribute change made through a handle; a removed node changes silently.
+    void _handleAttributesChanged(FSNode& node, JournalOp op, std::string_view name,
+                                  std::shared_ptr<const std::vector<char>> data = nullptr) {
+        if (!_isAttached(node)) {
+            node.meta.changed(detail::nowNanos());
+            return;
+        }
+        _attributesChanged(node);
+        if (journal) _journal(op, _pathOf(node), name, false, std::move(data));
+    }
+
+    // --- Access Heat ---
+    static constexpr unsigned kHeatCountBits = 40;
+    static constexpr uint64_t kHeatCountMask = (uint64_t(1) << kHeatCountBits) - 1;
+    static constexpr uint64_t kHeatMaxEpoch = (uint64_t(1) << (64 - kHeatCountBits)) - 1;
+
+    uint64_t _heatEpoch(int64_t now) const {
+        const int64_t elapsed = std::max<int64_t>(now - heatBase, 0);
+        return std::min<uint64_t>(static_cast<uint64_t>(elapsed / heatHalfLife), kHeatMaxEpoch);
+    }
+
+    // The count in `packed`, halved once for every epoch since it was last written.
+    static uint64_t _heatAt(uint64_t packed, uint64_t epoch) {
+        const uint64_t written = packed >> kHeatCountBits;
+        const uint64_t count = packed & kHeatCountMask;
+        if (epoch <= written) return count;
+        return epoch - written >= kHeatCountBits ? 0 : count >> (epoch - written);
+    }
+
+    // Only one read in sampleEvery, picked at random per thread, touches the node, adding
+    // sampleEvery so the estimate stays unbiased; the others write no shared cache line. The
+    // relaxed load and store may lose a concurrent sample, which only adds noise.
+    void _heat(const FSNode& node, uint32_t sampleEvery) const {
+        thread_local uint32_t state = 0x9E3779B9u ^ static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        if (state & (sampleEvery - 1)) return;
+        const uint64_t epoch = _heatEpoch(detail::nowNanos());
+        const uint64_t count = std::min(_heatAt(node.heat.load(std::memory_order_relaxed), epoch) + sampleEvery,
+                                        kHeatCountMask);
+        node.heat.store(count | (epoch << kHeatCountBits), std::memory_order_relaxed);
+    }
+
+    static void _clearHeat(const DirectoryNode& dir) {
+        dir.heat.store(0, std::memory_order_relaxed);
+        for (const auto& [name, child] : dir.children) {
+            if (child->getType() == NodeType::Directory) {
+                _clearHeat(static_cast<const DirectoryNode&>(*child));
+            } else {
+                child->heat.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Collects every entry below `dir` into the two bounded heaps and returns the subtree's heat.
+    uint64_t _collectHeat(const DirectoryNode& dir, const std::string& prefix, uint64_t epoch, size_t topK,
+                          std::vector<HeatEntry>& hottest, std::vector<HeatEntry>& coldest) const {
+        auto hotter = [](const HeatEntry& a, const HeatEntry& b) { return a.heat != b.heat ? a.heat > b.heat : a.path < b.path; };
+        auto colder = [](const HeatEntry& a, const HeatEntry& b) { return a.heat != b.heat ? a.heat < b.heat : a.path < b.path; };
+        uint64_t total = _heatAt(dir.heat.load(std::memory_order_relaxed), epoch);
+        for (const auto& [name, child] : dir.children) {
+            if (child->getType() == NodeType::Symlink || _expired(*child)) continue;
+            HeatEntry entry{prefix + "/" + name, child->getType(), 0};
+            entry.heat = child->getType() == NodeType::Directory
+                ? _collectHeat(static_cast<const DirectoryNode&>(*child), entry.path, epoch, topK, hottest, coldest)
+                : _heatAt(child->heat.load(std::memory_order_relaxed), epoch);
+            total += entry.heat;
+            // hottest is a min-heap of the topK largest (its front is the coolest kept), coldest the reverse.
+            if (hottest.size() < topK || hotter(entry, hottest.front())) {
+                hottest.push_back(entry);
+                std::push_heap(hottest.begin(), hottest.end(), hotter);
+                if (hottest.size() > topK) {
+                    std::pop_heap(hottest.begin(), hottest.end(), hotter);
+                    hottest.pop_back();
+                }
+            }
+            if (coldest.size() < topK || colder(entry, coldest.front())) {
+                coldest.push_back(std::move(entry));
+                std::push_heap(coldest.begin(), coldest.end(), colder);
+                if (coldest.size() > topK) {
+                    std::pop_heap(coldest.begin(), coldest.end(), colder);
+                    coldest.pop_back();
+                }
+            }
+        }
+        return total;
+    }
+
+    // --- Expiry ---
+    static bool _expired(const FSNode& node) noexcept {
+        return node.expiresAt != 0 && node.expiresAt <= detail::nowNanos();
+    }
+
+    // Wheel tick at which a deadline has passed (rounded up, so a timer never fires early).
+    static uint64_t _ttlTick(int64_t deadline) {
+        const auto nanos = static_cast<uint64_t>(deadline);
+        return nanos / kTtlTickNanos + (nanos % kTtlTickNanos != 0);
+    }
+
+    void _scheduleTtl(const std::shared_ptr<FSNode>& node, int64_t deadline) {
+        if (!ttlWheel) {
+            ttlWheel = std::make_unique<detail::TimerWheel<_TtlTimer>>(static_cast<uint64_t>(detail::nowNanos()) / kTtlTickNanos);
+        }
+        node->expiresAt = deadline;
+        ttlWheel->schedule(_ttlTick(deadline), {node, deadline});
+    }
+
+    // True if the node or one of its ancestors is past its TTL, i.e. already gone for readers.
+    bool _expiredPath(const FSNode& node) const {
+        if (!ttlWheel) return false;
+        std::shared_ptr<DirectoryNode> keep; // Holds each parent alive while walking
+        for (const FSNode* current = &node; current; current = (keep = current->parent.lock()).get()) {
+            if (_expired(*current)) return true;
+        }
+        return false;
+    }
+
+    // Fires every due TTL timer. Mutating calls run this first, so expiry needs no sweeper thread.
+    size_t _expireDue() {
+        if (!ttlWheel || ttlWheel->size() == 0) return 0;
+        std::vector<std::shared_ptr<FSNode>> due;
+        ttlWheel->advance(static_cast<uint64_t>(detail::nowNanos()) / kTtlTickNanos, [&](_TtlTimer timer) {
+            auto node = timer.node.lock();
+            if (node && node->expiresAt == timer.deadline) due.push_back(std::move(node));
+        });
+        size_t removed = 0;
+        for (auto& node : due) removed += _expire(std::move(node));
+        return removed;
+    }
+
+    // Removes every entry that links to the node and hands the node to the reclaimer to free.
+    bool _expire(std::shared_ptr<FSNode> node) {
+        node->expiresAt = 0;
+        if (!_isAttached(*node)) return false; // Removed by other means since the TTL was set
+        while (auto parent = node->parent.lock()) { // Dropping a file's primary link promotes the next one
+            const std::string path = journal ? _entryPath(*parent, node->name) : std::string();
+            _unlink(parent, parent->children.find(node->name));
+            if (journal) _journal(JournalOp::Remove, path, {}, true);
+        }
+        if (!reclaimer) reclaimer = std::make_unique<detail::Reclaimer>();
+        reclaimer->retire(std::move(node));
+        return true;
+    }
+
+    // Records a read according to the atime policy; a relaxed atomic, so const readers may race benignly.
+    void _accessed(const FSNode& node) const {
+        if (const uint32_t sampleEvery = heatSampleEvery.load(std::memory_order_relaxed)) _heat(node, sampleEvery);
+        const AtimePolicy policy = atimePolicy.load(std::memory_order_relaxed);
+        if (policy == AtimePolicy::None) return;
+        constexpr int64_t kRelaxedInterval = int64_t(24) * 3600 * 1000000000;
+        const int64_t atime = node.meta.atime.load(std::memory_order_relaxed);
+        if (policy == AtimePolicy::Relaxed && atime > node.meta.mtime && atime > node.meta.ctime) {
+            const int64_t now = detail::nowNanos();
+            if (now - atime < kRelaxedInterval) return;
+            node.meta.atime.store(now, std::memory_order_relaxed);
+            return;
+        }
+        node.meta.atime.store(detail::nowNanos(), std::memory_order_relaxed);
+    }
+
+    static void _copyAttributes(const FSNode& source, FSNode& dest) {
+        dest.meta.mode = source.meta.mode;
+        dest.meta.uid = source.meta.uid;
+        dest.meta.gid = source.meta.gid;
+        dest.xattrs = source.xattrs ? std::make_unique<detail::XattrMap>(*source.xattrs) : nullptr;
+    }
+
+    // --- Content Mutation ---
+    // Every change to an existing file's bytes goes through these so cached state stays coherent.
+    void _setContent(const std::shared_ptr<FileNode>& file, const std::vector<char>& content) {
+        const size_t oldSize = file->content.size();
+        file->content = content;
+        _contentChanged(file, oldSize);
+    }
+
+    // Invalidates derived state after a file's bytes were rewritten.
+    void _contentChanged(const std::shared_ptr<FileNode>& file, size_t oldSize) {
+        file->checksums.reset();
+        if (textIndex) textIndex->index(*file);
+        _contentModified(file, oldSize);
+    }
+
+    void _appendContent(const std::shared_ptr<FileNode>& file, const char* data, size_t n) {
+        const size_t oldSize = file->content.size();
+        file->content.insert(file->content.end(), data, data + n);
+        if (auto& cache = file->checksums) {
+            // Both algorithms are streaming, so the cached values are extended rather than dropped.
+            if (cache->hasCrc32c) cache->crc32c = detail::crc32c(cache->crc32c, data, n);
+            if (cache->hasXxh64) cache->xxh64.update(data, n);
+        }
+        if (textIndex) textIndex->append(*file, oldSize);
+        _contentModified(file, oldSize);
+    }
+
+    // Bookkeeping shared by every content change; checksums are the caller's responsibility.
+    void _contentModified(const std::shared_ptr<FileNode>& file, size_t oldSize) {
+        const int64_t oldMtime = file->meta.mtime;
+        file->meta.modified(detail::nowNanos());
+        const size_t newSize = file->content.size();
+        auto resize = [&](DirectoryNode* dir) {
+            if (newSize > oldSize) _growSize(dir, newSize - oldSize);
+            else _shrinkSize(dir, oldSize - newSize);
+        };
+        resize(file->parent.lock().get());
+        if (linkAccounting == LinkAccounting::CountEach) {
+            for (const auto& link : file->extraLinks) resize(link.parent.lock().get());
+        }
+        if (indexes) indexes->update(*file, oldSize, oldMtime);
+        _markMerkleDirty(*file);
+        if (!watchers.empty()) _notifyLinks(WatchModify, *file);
+    }
+
+    static uint64_t _checksum(const FileNode& file, ChecksumAlgorithm algo) {
+        if (!file.checksums) file.checksums = std::make_unique<detail::ChecksumCache>();
+        auto& cache = *file.checksums;
+        if (algo == ChecksumAlgorithm::CRC32C) {
+            if (!cache.hasCrc32c) {
+                cache.crc32c = detail::crc32c(0, file.content.data(), file.content.size());
+                cache.hasCrc32c = true;
+            }
+            return cache.crc32c;
+        }
+        if (!cache.hasXxh64) {
+            cache.xxh64 = detail::Xxh64State();
+            cache.xxh64.update(file.content.data(), file.content.size());
+            cache.hasXxh64 = true;
+        }
+        return cache.xxh64.digest();
+    }
+
+    static void _copyContent(const FileNode& source, FileNode& dest) {
+        _copyAttributes(source, dest);
+        dest.content = source.content;
+        if (source.checksums) dest.checksums = std::make_unique<detail::ChecksumCache>(*source.checksums);
+    }
+
+    void _recursiveCopy(const std::shared_ptr<DirectoryNode>& source, std::shared_ptr<DirectoryNode>& dest) {
+        for (const auto& [name, child] : source->children) {
+            if (child->getType() == NodeType::File) {
+                auto oldFile = std::static_pointer_cast<FileNode>(child);
+                auto newFile = std::make_shared<FileNode>(oldFile->name, dest);
+                _copyContent(*oldFile, *newFile);
+                _link(dest, name, newFile);
+            } else if (child->getType() == NodeType::Symlink) {
+                const auto& oldLink = static_cast<const SymlinkNode&>(*child); // Copied as a link, like cp -R
+                auto newLink = std::make_shared<SymlinkNode>(name, dest, oldLink.target);
+                _copyAttributes(oldLink, *newLink);
+                _link(dest, name, newLink);
+            } else {
+                auto oldDir = std::static_pointer_cast<DirectoryNode>(child);
+                auto newDir = std::make_shared<DirectoryNode>(oldDir->name, dest);
+                _copyAttributes(*oldDir, *newDir);
+                _link(dest, name, newDir);
+                _recursiveCopy(oldDir, newDir);
+            }
+        }
+    }
+
+
+    // Collects every file under `node` (or the node itself) together with its absolute path.
+    void _collectFiles(const std::shared_ptr<FSNode>& node, const std::string& path, bool recursive,
+                       std::vector<std::pair<std::string, std::shared_ptr<FileNode>>>& out) const {
+        if (node->getType() == NodeType::File) {
+            out.emplace_back(path, std::static_pointer_cast<FileNode>(node));
+            return;
+        }
+        auto dirNode = std::static_pointer_cast<DirectoryNode>(node);
+        const std::string prefix = (path == "/") ? path : path + "/";
+        for (const auto& [name, child] : dirNode->children) {
+            if (child->getType() == NodeType::Symlink) continue; // Links are not followed while walking
+            if (_expired(*child)) continue;
+            if (child->getType() == NodeType::Directory && !recursive) continue;
+            _collectFiles(child, prefix + name, recursive, out);
+        }
+    }
+
+    // Scans one file buffer in place and appends its matches to `out`.
+    static void _grepBuffer(const std::string& path, const std::vector<char>& content, std::string_view pattern,
+                            const detail::SimpleRegex* regex, size_t maxMatches, std::vector<GrepMatch>& out) {
+        const char* begin = content.data();
+        const char* end = begin + content.size();
+        const char* lineStart = begin; // Start of the line containing `countedTo`
+        const char* countedTo = begin; // Newlines before this point are already counted
+        size_t line = 1;
+        size_t found = 0;
+
+        auto report = [&](const char* matchBegin, size_t length) {
+            for (const char* nl; (nl = static_cast<const char*>(
+                     std::memchr(countedTo, '\n', static_cast<size_t>(matchBegin - countedTo))));) {
+                ++line;
+                countedTo = lineStart = nl + 1;
+            }
+            countedTo = matchBegin;
+            const char* lineEnd = static_cast<const char*>(std::memchr(matchBegin, '\n', static_cast<size_t>(end - matchBegin)));
+            if (!lineEnd) lineEnd = end;
+            out.push_back({path, static_cast<size_t>(matchBegin - begin), length, line,
+                           std::string(lineStart, lineEnd)});
+            return maxMatches == 0 || ++found < maxMatches;
+        };
+
+        if (!regex) {
+            if (pattern.empty()) return;
+            for (const char* p = begin;
+                 (p = detail::findSubstring(p, static_cast<size_t>(end - p), pattern.data(), pattern.size()));
+                 p += pattern.size()) {
+                if (!report(p, pattern.size())) return;
+            }
+            return;
+        }
+
+        const std::string& required = regex->requiredLiteral();
+        const char* cursor = begin;
+        while (cursor <= end) {
+            if (!required.empty()) {
+                const char* hit = detail::findSubstring(cursor, static_cast<size_t>(end - cursor),
+                                                        required.data(), required.size());
+                if (!hit) return;
+                // Rewind to the start of the line that holds the required literal.
+                while (hit > cursor && hit[-1] != '\n') --hit;
+                cursor = hit;
+            }
+            const char* eol = static_cast<const char*>(std::memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+            if (!eol) eol = end;
+            for (const char* from = cursor, *mb, *me; from <= eol && regex->search(cursor, eol, from, mb, me);) {
+                if (!report(mb, static_cast<size_t>(me - mb))) return;
+                from = (me == mb) ? me + 1 : me;
+            }
+            if (eol == end) return;
+            cursor = eol + 1;
+        }
+    }
+
+public:
+    FileSystem() : root(std::make_shared<DirectoryNode>("/", nullptr)) {}
+
+    // --- Core API ---
+    void mkdir(std::string_view path) {
+        EMFS_OP(Mkdir, path);
+        _expireDue();
+        if (path == "/") return;
+
+        std::string path_str(path);
+        std::stringstream ss(path_str);
+        std::string component;
+        auto current = root;
+
+        if (ss.peek() == '/') ss.ignore();
+
+        while (std::getline(ss, component, '/')) {
+            if (component.empty()) continue;
+            auto it = current->children.find(component);
+            if (it == current->children.end()) {
+                auto newDir = std::make_shared<DirectoryNode>(component, current);
+                _link(current, component, newDir);
+                current = newDir;
+            } else {
+                const FSNode* next = it->second.get();
+                if (next->getType() == NodeType::Symlink) {
+                    int hops = 0;
+                    _WalkError error = _WalkError::None;
+                    next = _follow(static_cast<const SymlinkNode&>(*next), current.get(), hops, error);
+                }
+                if (!next || next->getType() != NodeType::Directory) {
+                    throw FileSystemException("A file exists at path component: " + component);
+                }
+                current = _asDirectory(std::const_pointer_cast<FSNode>(next->shared_from_this()));
+            }
+        }
+        if (journal) _journal(JournalOp::Mkdir, path);
+    }
+
+    void touch(std::string_view path) {
+        EMFS_OP(Touch, path);
+        _expireDue();
+        auto [parent, fileName] = _resolveParentAndName(path);
+        auto it = parent->children.find(fileName);
+        if (it != parent->children.end()) {
+            auto node = it->second->getType() == NodeType::Symlink ? _resolvePath(path) : it->second;
+            if (node->getType() != NodeType::File) {
+                 throw FileSystemException("Cannot touch '" + std::string(path) + "', a directory with that name exists.");
+            }
+            _touch(static_cast<FileNode&>(*node)); // Existing file: only its timestamps change
+            if (journal) _journal(JournalOp::Touch, path);
+            return;
+        }
+        _link(parent, fileName, std::make_shared<FileNode>(fileName, parent));
+        if (journal) _journal(JournalOp::Touch, path);
+    }
+
+    void writeFile(std::string_view path, const std::vector<char>& content) {
+        EMFS_OP(WriteFile, path, std::string_view(), std::string_view(content.data(), content.size()));
+        EMFS_OP_BYTES(content.size());
+        _expireDue();
+        auto [parent, fileName] = _resolveParentAndName(path);
+        auto it = parent->children.find(fileName);
+        if (it != parent->children.end()) {
+            auto node = it->second->getType() == NodeType::Symlink ? _resolvePath(path) : it->second;
+            if (node->getType() == NodeType::Directory) {
+                throw FileSystemException("Cannot write to '" + fileName + "', it is a directory.");
+            }
+            _setContent(std::static_pointer_cast<FileNode>(node), content);
+        } else {
+            auto file = std::make_shared<FileNode>(fileName, parent);
+            file->content = content;
+            _link(parent, fileName, file);
+        }
+        if (journal) _journal(JournalOp::Write, path, {}, false, _payload(content.data(), content.size()));
+    }
+    
+    void writeFile(std::string_view path, std::string_view content) {
+        writeFile(path, std::vector<char>(content.begin(), content.end()));
+    }
+
+    /// Writes a file and sets its TTL; see setTtl().
+    void writeFile(std::string_view path, std::string_view content, std::chrono::nanoseconds ttl) {
+        writeFile(path, content);
+        setTtl(path, ttl);
+    }
+
+    void append(std::string_view path, const std::vector<char>& content) {
+        EMFS_OP(Append, path, std::string_view(), std::string_view(content.data(), content.size()));
+        EMFS_OP_BYTES(content.size());
+        _expireDue();
+        auto node = _resolvePath(path);
+        if (node->getType() != NodeType::File) {
+            throw FileSystemException("Path is not a file: " + std::string(path));
+        }
+        _appendContent(std::static_pointer_cast<FileNode>(node), content.data(), content.size());
+        if (journal) _journal(JournalOp::Append, path, {}, false, _payload(content.data(), content.size()));
+    }
+
+    void append(std::string_view path, std::string_view content) {
+        append(path, std::vector<char>(content.begin(), content.end()));
+    }
+
+    std::vector<char> cat(std::string_view path) const {
+        EMFS_OP(Cat, path);
+        auto node = _resolvePath(path);
+        if (node->getType() != NodeType::File) {
+            throw FileSystemException("Path is not a file: " + std::string(path));
+        }
+        _accessed(*node);
+        EMFS_OP_BYTES(node->size());
+        return std::static_pointer_cast<FileNode>(node)->content;
+    }
+
+    std::string catAsString(std::string_view path) const {
+        auto content = cat(path);
+        return std::string(content.begin(), content.end());
+    }
+
+    void rm(std::string_view path, bool recursive = false) {
+        EMFS_OP(Rm, path);
+        EMFS_OP_RECURSIVE(recursive);
+        _expireDue();
+        if (path == "/") throw FileSystemException("Cannot remove the root directory.");
+        auto [parent, name] = _resolveParentAndName(path);
+        auto it = parent->children.find(name);
+        if (it == parent->children.end()) {
+            throw FileSystemException("Path not found: " + std::string(path));
+        }
+        if (it->second->getType() == NodeType::Directory && !recursive) {
+            if (!std::static_pointer_cast<DirectoryNode>(it->second)->children.empty()) {
+                throw FileSystemException("Directory not empty, use recursive flag: " + std::string(path));
+            }
+        }
+        _unlink(parent, it);
+        if (journal) _journal(JournalOp::Remove, path, {}, recursive);
+    }
+
+    void cp(std::string_view sourcePath, std::string_view destPath) {
+        EMFS_OP(Cp, sourcePath, destPath);
+        _expireDue();
+        auto sourceNode = _resolvePath(sourcePath);
+        auto [destParent, newName] = _resolveDestination(destPath, _resolveEntry(sourcePath).second);
+
+        if (destParent->children.count(newName)) {
+            throw FileSystemException("Destination already exists: " + std::string(destPath) + "/" + newName);
+        }
+
+        EMFS_OP_BYTES(sourceNode->size());
+        if (sourceNode->getType() == NodeType::File) {
+            EMFS_TRACE_PHASE(Copy, sourcePath, sourceNode->size());
+            auto oldFile = std::static_pointer_cast<FileNode>(sourceNode);
+            auto newFile = std::make_shared<FileNode>(newName, destParent);
+            _copyContent(*oldFile, *newFile);
+            _link(destParent, newName, newFile);
+        } else {
+            EMFS_TRACE_PHASE(Copy, sourcePath, sourceNode->size());
+            auto oldDir = std::static_pointer_cast<DirectoryNode>(sourceNode);
+            auto newDir = std::make_shared<DirectoryNode>(newName, destParent);
+            _copyAttributes(*oldDir, *newDir);
+            _link(destParent, newName, newDir);
+            _recursiveCopy(oldDir, newDir);
+        }
+        if (journal) _journal(JournalOp::Copy, sourcePath, destPath);
+    }
+
+    void mv(std::string_view sourcePath, std::string_view destPath) {
+        EMFS_OP(Mv, sourcePath, destPath);
+        _expireDue();
+        if (sourcePath == "/") throw FileSystemException("Cannot move the root directory.");
+        auto sourceNode = _resolvePath(sourcePath, false); // A symlink is moved, not its target
+        auto [oldParent, oldName] = _resolveEntry(sourcePath);
+        if (!oldParent) throw FileSystemException("Internal error: source node has no parent.");
+        
+        auto [newParent, newName] = _resolveDestination(destPath, oldName);
+        if (newParent->children.count(newName)) {
+            throw FileSystemException("Destination already exists: " + std::string(destPath) + "/" + newName);
+        }
+        
+        // Check for moving a directory into itself
+        auto tempParent = newParent;
+        while(tempParent) {
+            if (tempParent.get() == sourceNode.get()) {
+                throw FileSystemException("Cannot move a directory into itself.");
+            }
+            tempParent = tempParent->parent.lock();
+        }
+
+        _move(oldParent, oldParent->children.find(oldName), newParent, newName);
+        if (journal) _journal(JournalOp::Move, sourcePath, destPath);
+    }
+
+    /**
+     * @brief Creates a hard link: `newPath` becomes another name for the file at `existingPath`.
+     * @details All links share content and metadata, so a write through one is visible through every
+     *          other. The content is released when the last link is removed. Directories cannot be
+     *          hard-linked.
+     */
+    void link(std::string_view existingPath, std::string_view newPath) {
+        EMFS_OP(Link, existingPath, newPath);
+        _expireDue();
+        auto node = _resolvePath(existingPath);
+        if (node->getType() != NodeType::File) {
+            throw FileSystemException("Cannot hard-link a directory: " + std::string(existingPath));
+        }
+        auto [parent, name] = _resolveParentAndName(newPath);
+        if (parent->children.count(name)) {
+            throw FileSystemException("Destination already exists: " + std::string(newPath));
+        }
+        _link(parent, name, node);
+        node->meta.changed(detail::nowNanos());
+        if (journal) _journal(JournalOp::Link, existingPath, newPath);
+    }
+
+    /**
+     * @brief Creates a symbolic link at `linkPath` pointing to `target`, like `ln -s target linkPath`.
+     * @details `target` is stored as given and resolved on every access: absolute, or relative to the
+     *          link's directory. It need not exist yet. Lookups follow at most 40 links, then fail
+     *          as ELOOP would.
+     */
+    void symlink(std::string_view target, std::string_view linkPath) {
+        EMFS_OP(Symlink, linkPath, target);
+        _expireDue();
+        if (target.empty()) throw FileSystemException("Symlink target cannot be empty.");
+        auto [parent, name] = _resolveParentAndName(linkPath);
+        if (parent->children.count(name)) {
+            throw FileSystemException("Destination already exists: " + std::string(linkPath));
+        }
+        _link(parent, name, std::make_shared<SymlinkNode>(name, parent, std::string(target)));
+        if (journal) _journal(JournalOp::Symlink, linkPath, target);
+    }
+
+    /**
+     * @brief Points an existing symbolic link at a new target in one step, e.g. to switch releases.
+     * @details The link node is updated in place, so there is no moment at which the path is missing.
+     *          Cached resolutions are invalidated by bumping the tree generation, which is O(1).
+     */
+    void retarget(std::string_view linkPath, std::string_view target) {
+        EMFS_OP(Retarget, linkPath, target);
+        _expireDue();
+        if (target.empty()) throw FileSystemException("Symlink target cannot be empty.");
+        auto node = _resolvePath(linkPath, false);
+        if (node->getType() != NodeType::Symlink) {
+            throw FileSystemException("Path is not a symbolic link: " + std::string(linkPath));
+        }
+        static_cast<SymlinkNode&>(*node).target = std::string(target);
+        ++treeGeneration;
+        node->meta.modified(detail::nowNanos());
+        _markMerkleDirty(*node);
+        if (!watchers.empty()) _notify(WatchModify, *node, _pathOf(*node));
+        if (journal) _journal(JournalOp::Retarget, linkPath, target);
+    }
+
+    /// Returns the target of a symbolic link, as it was given.
+    std::string readlink(std::string_view path) const {
+        EMFS_OP(Readlink, path);
+        const FSNode& node = _node(path, false);
+        if (node.getType() != NodeType::Symlink) {
+            throw FileSystemException("Path is not a symbolic link: " + std::string(path));
+        }
+        return static_cast<const SymlinkNode&>(node).target;
+    }
+
+    std::vector<std::string> ls(std::string_view path) const {
+        EMFS_OP(Ls, path);
+        auto node = _resolvePath(path);
+        if (node->getType() != NodeType::Directory) {
+            throw FileSystemException("Path is not a directory: " + std::string(path));
+        }
+        _accessed(*node);
+        std::vector<std::string> entries;
+        auto dirNode = std::static_pointer_cast<DirectoryNode>(node);
+        for (const auto& [name, child] : dirNode->children) {
+            if (_expired(*child)) continue;
+            entries.push_back(name + (child->getType() == NodeType::Directory ? "/" : ""));
+        }
+        std::sort(entries.begin(), entries.end());
+        return entries;
+    }
+
+    /**
+     * @brief Lists a directory together with each entry's stat data, in one pass over its children.
+     * @details Entries are ordered and paged by `options`. When a limit is set, only the first
+     *          `offset + limit` entries are fully sorted.
+     */
+    std::vector<DirEntry> lsDetailed(std::string_view path, const ListOptions& options = {}) const {
+        EMFS_OP(LsDetailed, path);
+        const FSNode& node = _node(path);
+        if (node.getType() != NodeType::Directory) {
+            throw FileSystemException("Path is not a directory: " + std::string(path));
+        }
+        _accessed(node);
+        using Entry = std::pair<const std::string, std::shared_ptr<FSNode>>;
+        const auto& children = static_cast<const DirectoryNode&>(node).children;
+        std::vector<const Entry*> order;
+        order.reserve(children.size());
+        for (const auto& entry : children) {
+            if (!_expired(*entry.second)) order.push_back(&entry);
+        }
+
+        auto before = [sortBy = options.sortBy](const Entry* a, const Entry* b) {
+            if (sortBy == ListSort::Size && a->second->size() != b->second->size()) {
+                return a->second->size() < b->second->size();
+            }
+            if (sortBy == ListSort::Mtime && a->second->meta.mtime != b->second->meta.mtime) {
+                return a->second->meta.mtime < b->second->meta.mtime;
+            }
+            return a->first < b->first;
+        };
+        auto compare = [&](const Entry* a, const Entry* b) { return options.reverse ? before(b, a) : before(a, b); };
+
+        const size_t begin = std::min(options.offset, order.size());
+        const size_t end = begin + std::min(options.limit, order.size() - begin);
+        if (end < order.size()) {
+            std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(end), order.end(), compare);
+        } else {
+            std::sort(order.begin(), order.end(), compare);
+        }
+
+        std::vector<DirEntry> entries;
+        entries.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) entries.push_back({order[i]->first, _stat(*order[i]->second)});
+        return entries;
+    }
+
+    bool exists(std::string_view path) const noexcept {
+        EMFS_OP(Exists, path);
+        return _lookup(path) != nullptr;
+    }
+
+    NodeType getNodeType(std::string_view path) const {
+        EMFS_OP(GetNodeType, path);
+        return _node(path).getType();
+    }
+    
+    /// Returns the file size, or a directory's total. Totals still count expired nodes until they are swept.
+    size_t size(std::string_view path) const {
+        EMFS_OP(Size, path);
+        return _node(path).size();
+    }
+
+    /**
+     * @brief Returns type, size, child count, timestamps, ownership and version of a node with one lookup.
+     * @details Symbolic links are followed. Does not count as an access, so atime is left untouched.
+     */
+    NodeStat stat(std::string_view path) const {
+        EMFS_OP(Stat, path);
+        return _stat(_node(path));
+    }
+
+    /// Like stat(), but reports a symbolic link itself rather than its target.
+    NodeStat lstat(std::string_view path) const {
+        EMFS_OP(Lstat, path);
+        return _stat(_node(path, false));
+    }
+
+    /**
+     * @brief Stats many paths; missing ones yield std::nullopt instead of throwing.
+     */
+    std::vector<std::optional<NodeStat>> stat(const std::vector<std::string_view>& paths) const {
+        EMFS_OP(Stat, std::string_view());
+        std::vector<std::optional<NodeStat>> result;
+        result.reserve(paths.size());
+        for (std::string_view path : paths) {
+            const FSNode* node = _lookup(path);
+            result.push_back(node ? std::optional<NodeStat>(_stat(*node)) : std::nullopt);
+        }
+        return result;
+    }
+    
+    // --- Checksums ---
+
+    /**
+     * @brief Returns the checksum of a file's content.
+     * @details The value is cached on the file node; `writeFile` invalidates it and `append` extends it
+     *          incrementally, so repeated integrity checks only hash bytes that changed. Filling the
+     *          cache writes to the node, so unlike other const readers this needs exclusive access.
+     * @param path Absolute path of the file.
+     * @param algo CRC32C (result in the low 32 bits) or XXH64.
+     */
+    uint64_t checksum(std::string_view path, ChecksumAlgorithm algo = ChecksumAlgorithm::CRC32C) const {
+        EMFS_OP(Checksum, path);
+        auto node = _resolvePath(path);
+        if (node->getType() != NodeType::File) {
+            throw FileSystemException("Path is not a file: " + std::string(path));
+        }
+        return _checksum(static_cast<const FileNode&>(*node), algo);
+    }
+
+    // --- Merkle Hashes ---
+
+    /**
+     * @brief Returns the Merkle hash of a file or directory.
+     * @details A directory's hash covers its children's names and hashes. Hashes are computed lazily and
+     *          cached; a mutation only dirty-flags the path up to the root, so rehashing after a change
+     *          costs O(depth) and an unchanged subtree costs O(1). Like checksum(), it writes the caches
+     *          and needs exclusive access, as do the diff and sync calls built on it. Expired nodes that
+     *          have not been swept yet are still hashed; call expire() first for an exact hash.
+     */
+    uint64_t treeHash(std::string_view path) const {
+        EMFS_OP(TreeHash, path);
+        return _merkleHash(*_resolvePath(path));
+    }
+
+    /**
+     * @brief Tests whether two subtrees (or files) have identical names and content.
+     */
+    bool subtreeEquals(std::string_view pathA, std::string_view pathB) const {
+        return subtreeEquals(pathA, *this, pathB);
+    }
+
+    /**
+     * @brief Compares a subtree of this file system with a subtree of `other`.
+     */
+    bool subtreeEquals(std::string_view pathA, const FileSystem& other, std::string_view pathB) const {
+        EMFS_OP(SubtreeEquals, pathA);
+        auto a = _resolvePath(pathA);
+        auto b = other._resolvePath(pathB);
+        return a == b || _merkleHash(*a) == _merkleHash(*b);
+    }
+
+    // --- Tree Diff ---
+
+    /**
+     * @brief Reports what changed between two subtrees of this file system.
+     * @details Identical subtrees are pruned through shared-node identity or equal Merkle hashes, so once
+     *          hashes are cached the cost is proportional to the number of changes. An entry that was
+     *          removed from one place and added with the same hash elsewhere is reported as Renamed.
+     * @return Changes ordered by path, with paths relative to `pathA` and `pathB`.
+     */
+    std::vector<DiffEntry> diff(std::string_view pathA, std::string_view pathB) const {
+        return diff(pathA, *this, pathB);
+    }
+
+    /**
+     * @brief Reports what changed between a subtree of this file system and a subtree of `other`.
+     */
+    std::vector<DiffEntry> diff(std::string_view pathA, const FileSystem& other, std::string_view pathB) const {
+        EMFS_OP(Diff, pathA);
+        auto a = _resolvePath(pathA);
+        auto b = other._resolvePath(pathB);
+        std::vector<DiffEntry> changes;
+        if (a == b || _merkleHash(*a) == _merkleHash(*b)) return changes;
+        if (a->getType() != NodeType::Directory || b->getType() != NodeType::Directory) {
+            if (a->getType() == b->getType()) {
+                changes.push_back({DiffKind::Modified, NodeType::File, "/", {}});
+            } else {
+                changes.push_back({DiffKind::Removed, a->getType(), "/", {}});
+                changes.push_back({DiffKind::Added, b->getType(), "/", {}});
+            }
+            return changes;
+        }
+
+        std::vector<_DiffSide> removed, added;
+        _diffDirectories(static_cast<const DirectoryNode&>(*a), static_cast<const DirectoryNode&>(*b), "/",
+                         changes, removed, added);
+
+        // Pair removals with additions of identical content to detect renames.
+        std::unordered_multimap<uint64_t, size_t> removedByHash;
+        for (size_t i = 0; i < removed.size(); ++i) removedByHash.emplace(_merkleHash(*removed[i].node), i);
+        std::vector<bool> renamed(removed.size(), false);
+        for (const auto& add : added) {
+            auto range = removedByHash.equal_range(_merkleHash(*add.node));
+            auto match = std::find_if(range.first, range.second, [&](const auto& entry) {
+                return !renamed[entry.second] && removed[entry.second].node->getType() == add.node->getType();
+            });
+            if (match != range.second) {
+                renamed[match->second] = true;
+                changes.push_back({DiffKind::Renamed, add.node->getType(), add.path, removed[match->second].path});
+            } else {
+                changes.push_back({DiffKind::Added, add.node->getType(), add.path, {}});
+            }
+        }
+        for (size_t i = 0; i < removed.size(); ++i) {
+            if (!renamed[i]) changes.push_back({DiffKind::Removed, removed[i].node->getType(), removed[i].path, {}});
+        }
+        std::sort(changes.begin(), changes.end(),
+                  [](const DiffEntry& x, const DiffEntry& y) { return x.path < y.path; });
+        return changes;
+    }
+
+    // --- Delta Sync ---
+
+    /**
+     * @brief Computes the operations that make `dstPath` in `dst` a copy of `srcPath` in this file system.
+     * @details Subtrees with equal Merkle hashes are skipped. Modified files are encoded rsync-style: the
+     *          destination content is indexed by rolling and strong block checksums, and the source is
+     *          expressed as matching blocks plus literal bytes. The result can be serialized and
+     *          applied by another process that holds the same destination state.
+     */
+    SyncDelta makeSyncDelta(std::string_view srcPath, const FileSystem& dst, std::string_view dstPath,
+                            const SyncOptions& options = {}) const {
+        EMFS_OP(MakeSyncDelta, srcPath);
+        if (options.blockSize == 0) throw FileSystemException("Sync block size must be positive.");
+        auto src = _resolvePath(srcPath);
+        SyncDelta delta;
+        delta.blockSize = options.blockSize;
+        std::shared_ptr<FSNode> target;
+        try {
+            target = dst._resolvePath(dstPath);
+        } catch (const FileSystemException&) {
+            _deltaCreate(*src, "/", delta);
+            return delta;
+        }
+        if (src == target || _merkleHash(*src) == _merkleHash(*target)) return delta;
+        if (src->getType() == NodeType::Directory && target->getType() == NodeType::Directory) {
+            _deltaDirectories(static_cast<const DirectoryNode&>(*src), static_cast<const DirectoryNode&>(*target), "/",
+                              options, delta);
+        } else if (src->getType() == NodeType::File && target->getType() == NodeType::File) {
+            _deltaFile(static_cast<const FileNode&>(*src), static_cast<const FileNode&>(*target), "/", options, delta);
+        } else {
+            delta.ops.push_back({SyncDelta::OpType::Remove, "/", {}, {}});
+            _deltaCreate(*src, "/", delta);
+        }
+        return delta;
+    }
+
+    /**
+     * @brief Applies a SyncDelta to the subtree rooted at `dstPath`.
+     * @details A delta with a path that SyncDelta::validPath() rejects throws before anything is applied.
+     */
+    SyncStats applySyncDelta(std::string_view dstPath, const SyncDelta& delta) {
+        EMFS_OP(ApplySyncDelta, dstPath);
+        for (const auto& op : delta.ops) {
+            if (!SyncDelta::validPath(op.path)) throw FileSystemException("Invalid path in sync delta: " + op.path);
+        }
+        SyncStats stats;
+        const std::string base(dstPath);
+        for (const auto& op : delta.ops) {
+            const std::string path = _joinPath(base, op.path);
+            switch (op.type) {
+                case SyncDelta::OpType::MakeDir:
+                    mkdir(path);
+                    ++stats.directoriesCreated;
+                    break;
+                case SyncDelta::OpType::Remove:
+                    rm(path, true);
+                    ++stats.entriesRemoved;
+                    break;
+                case SyncDelta::OpType::WriteFile:
+                    writeFile(path, std::string_view(op.data));
+                    ++stats.filesWritten;
+                    stats.literalBytes += op.data.size();
+                    break;
+                case SyncDelta::OpType::MakeSymlink:
+                    symlink(op.data, path);
+                    ++stats.symlinksCreated;
+                    break;
+                case SyncDelta::OpType::PatchFile: {
+                    auto node = _resolvePath(path);
+                    if (node->getType() != NodeType::File) {
+                        throw FileSystemException("Sync delta patches a non-file: " + path);
+                    }
+                    auto file = std::static_pointer_cast<FileNode>(node);
+                    _applyPatch(file, delta, op, stats);
+                    if (journal) {
+                        const std::string patch = SyncDelta::encodePatch(delta.blockSize, op.chunks);
+                        _journal(JournalOp::Patch, path, {}, false, _payload(patch.data(), patch.size()));
+                    }
+                    ++stats.filesPatched;
+                    break;
+                }
+            }
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Makes `dstPath` in `dst` a copy of `srcPath`, transferring only changed blocks.
+     */
+    SyncStats sync(std::string_view srcPath, FileSystem& dst, std::string_view dstPath,
+                   const SyncOptions& options = {}) const {
+        return dst.applySyncDelta(dstPath, makeSyncDelta(srcPath, dst, dstPath, options));
+    }
+
+    // --- Secondary Indexes ---
+
+    /**
+     * @brief Builds extension, size and modification-time indexes over every file.
+     * @details Once enabled, the indexes are maintained incrementally by every mutation and `find`
+     *          answers from them instead of walking the tree.
+     */
+    void enableIndexes() {
+        EMFS_OP(EnableIndexes, std::string_view());
+        if (indexes) return;
+        indexes = std::make_unique<detail::SecondaryIndexes>();
+        _forEachFile(*root, [this](const FileNode& file) { indexes->insert(file); });
+    }
+
+    void disableIndexes() {
+        EMFS_OP(DisableIndexes, std::string_view());
+        indexes.reset();
+    }
+
+    bool indexesEnabled() const { return indexes != nullptr; }
+
+    /**
+     * @brief Returns the paths of all files matching `query`, sorted.
+     * @details Uses the secondary indexes when enabled (O(results * log n)); otherwise walks the tree.
+     */
+    std::vector<std::string> find(const FileQuery& query) const {
+        EMFS_OP(Find, std::string_view());
+        std::vector<std::string> paths;
+        if (indexes) {
+            for (const FileNode* file : indexes->query(query)) {
+                if (!_expiredPath(*file)) paths.push_back(_pathOf(*file));
+            }
+        } else {
+            detail::SecondaryIndexes scratch;
+            std::vector<std::pair<std::string, std::shared_ptr<FileNode>>> files;
+            _collectFiles(root, "/", true, files);
+            for (const auto& entry : files) scratch.insert(*entry.second);
+            for (const FileNode* file : scratch.query(query)) paths.push_back(_pathOf(*file));
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    // --- Full-Text Index ---
+
+    /**
+     * @brief Builds an inverted index over all file contents.
+     * @details The index is then updated incrementally: `writeFile` re-indexes the file, `append`
+     *          tokenizes only the new bytes, `rm` tombstones the file and `mv` costs nothing.
+     */
+    void enableFullTextIndex() {
+        EMFS_OP(EnableFullTextIndex, std::string_view());
+        if (textIndex) return;
+        textIndex = std::make_unique<detail::InvertedIndex>();
+        _forEachFile(*root, [this](const FileNode& file) { textIndex->index(file); });
+    }
+
+    void disableFullTextIndex() {
+        EMFS_OP(DisableFullTextIndex, std::string_view());
+        textIndex.reset();
+    }
+
+    bool fullTextIndexEnabled() const { return textIndex != nullptr; }
+
+    /**
+     * @brief Returns the sorted paths of files matching a keyword query.
+     * @param query Terms joined by `AND` / `OR` (adjacent terms imply AND), matched case-insensitively.
+     * @throws FileSystemException if the full-text index is not enabled.
+     */
+    std::vector<std::string> search(std::string_view query) const {
+        EMFS_OP(Search, std::string_view());
+        if (!textIndex) throw FileSystemException("Full-text index is not enabled.");
+        std::vector<std::string> paths;
+        for (const FileNode* file : textIndex->search(query)) {
+            if (!_expiredPath(*file)) paths.push_back(_pathOf(*file));
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    /**
+     * @brief Heap bytes held by the full-text index, reported separately from file content.
+     */
+    size_t fullTextIndexMemory() const { return textIndex ? textIndex->memoryUsage() : 0; }
+
+    // --- Change Notification ---
+
+    /**
+     * @brief Watches a path for changes, inotify-style, delivering events to a bounded lock-free queue.
+     * @param path Directory or file to watch. A directory watch covers its direct children, or every
+     *             descendant when `recursive` is true.
+     * @param recursive Whether the watch covers the whole subtree.
+     * @param mask WatchMask bits to deliver.
+     * @param capacity Queue capacity (rounded up to a power of two); events beyond it are dropped and
+     *                 reported with WatchOverflow.
+     * @return The watcher; poll it from any thread.
+     */
+    std::shared_ptr<Watcher> watch(std::string_view path, bool recursive = false, uint32_t mask = WatchAll,
+                                   size_t capacity = 1024) {
+        EMFS_OP(Watch, path);
+        return _addWatcher(path, recursive, mask, capacity, nullptr);
+    }
+
+    /**
+     * @brief Watches a path and invokes `callback` synchronously on the mutating thread for each event.
+     * @note The callback must not block and must not mutate this file system.
+     */
+    std::shared_ptr<Watcher> watch(std::string_view path, bool recursive, uint32_t mask, Watcher::Callback callback) {
+        EMFS_OP(Watch, path);
+        if (!callback) throw FileSystemException("Watch callback cannot be empty.");
+        return _addWatcher(path, recursive, mask, 0, std::move(callback));
+    }
+
+    /**
+     * @brief Stops delivering events to a watcher. Events already queued stay available to poll().
+     */
+    void unwatch(const std::shared_ptr<Watcher>& watcher) {
+        EMFS_OP(Unwatch, std::string_view());
+        watchers.erase(std::remove(watchers.begin(), watchers.end(), watcher), watchers.end());
+    }
+
+    // --- Snapshots ---
+
+    /**
+     * @brief Serializes the whole tree (names and file content) as a self-delimiting binary frame.
+     */
+    void saveSnapshot(std::ostream& out) const {
+        EMFS_OP(SaveSnapshot, std::string_view());
+        std::string payload;
+        detail::BinaryWriter writer(payload);
+        std::unordered_map<const FileNode*, uint64_t> linked;
+        _encodeNode(root->name, *root, writer, linked);
+        std::string header("EMFSSNP4");
+        detail::BinaryWriter(header).u64(payload.size());
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        if (!out) throw FileSystemException("Failed to write snapshot.");
+    }
+
+    /**
+     * @brief Replaces the whole tree with one written by saveSnapshot().
+     * @details Indexes and watches see the change as removals and creations; the load itself is not
+     *          journaled. The snapshot is decoded in full before the current tree is touched, so a
+     *          corrupt or truncated one throws and leaves the file system as it was.
+     * @param keepTtls If false, nodes load without their TTLs. Replicas load this way, since the
+     *        primary's journaled removals expire the nodes for them.
+     */
+    void loadSnapshot(std::istream& in, bool keepTtls = true) {
+        EMFS_OP(LoadSnapshot, std::string_view());
+        char header[16];
+        if (!in.read(header, sizeof(header)) || std::memcmp(header, "EMFSSNP4", 8) != 0) {
+            throw FileSystemException("Stream does not contain a snapshot.");
+        }
+        const uint64_t length = detail::BinaryReader(std::string_view(header + 8, 8)).u64();
+        const std::string payload = detail::readExactly(in, length, "Truncated snapshot.");
+        FileSystem staged; // Without indexes, watches or a journal, decoding it has no side effects
+        staged.linkAccounting = linkAccounting;
+        staged._decodeSnapshot(payload, keepTtls);
+        _adoptTree(staged);
+    }
+
+    // --- Change Journal ---
+
+    /**
+     * @brief Starts recording every mutation in an ordered, bounded in-memory journal.
+     * @details Entries carry monotonically increasing sequence numbers. Write/Append payloads are copied
+     *          once into an immutable buffer per entry, since file content changes in place; readers
+     *          share that buffer rather than copying it again. A file patched by applySyncDelta is
+     *          journaled as a Patch entry carrying only the delta's chunks.
+     */
+    void enableJournal(const JournalOptions& options = {}) {
+        EMFS_OP(EnableJournal, std::string_view());
+        if (!journal) journal = std::make_unique<detail::ChangeJournal>(options);
+    }
+
+    void disableJournal() {
+        EMFS_OP(DisableJournal, std::string_view());
+        journal.reset();
+    }
+
+    bool journalEnabled() const { return journal != nullptr; }
+
+    /**
+     * @brief Returns a cursor positioned after the newest entry, for a subscriber that wants only new changes.
+     * @details A default-constructed cursor instead starts at sequence 1 (everything still retained).
+     */
+    JournalCursor subscribeJournal() const {
+        EMFS_OP(SubscribeJournal, std::string_view());
+        if (!journal) throw FileSystemException("Journal is not enabled.");
+        return JournalCursor{journal->nextSequence()};
+    }
+
+    /**
+     * @brief Appends up to `max` entries after `cursor` to `out` and advances the cursor.
+     * @details Safe to call from another thread while this file system is being mutated.
+     * @return Number of entries read.
+     * @throws FileSystemException if the cursor fell behind the retained window.
+     */
+    size_t readJournal(JournalCursor& cursor, std::vector<JournalEntry>& out, size_t max = SIZE_MAX) const {
+        EMFS_OP(ReadJournal, std::string_view());
+        if (!journal) throw FileSystemException("Journal is not enabled.");
+        return journal->read(cursor, out, max);
+    }
+
+    /// Sequence number of the oldest retained entry.
+    uint64_t journalFirstSequence() const { return journal ? journal->firstSequence() : 1; }
+
+    /// Sequence number the next mutation will receive.
+    uint64_t journalNextSequence() const { return journal ? journal->nextSequence() : 1; }
+
+    // --- Node Metadata ---
+
+    /**
+     * @brief Sets the permission bits of a file or directory.
+     * @details Only the low 12 bits (07777) are kept. Permissions are recorded, not enforced.
+     */
+    void chmod(std::string_view path, uint32_t mode) {
+        EMFS_OP(Chmod, path);
+        _expireDue();
+        auto node = _resolvePath(path);
+        node->meta.mode = static_cast<uint16_t>(mode & 07777);
+        _attributesChanged(*node);
+        if (journal) _journal(JournalOp::Chmod, path, {}, false, nullptr, node->meta.mode);
+    }
+
+    /// Sets the owning user and group ids of a file or directory.
+    void chown(std::string_view path, uint32_t uid, uint32_t gid) {
+        EMFS_OP(Chown, path);
+        _expireDue();
+        auto node = _resolvePath(path);
+        node->meta.uid = uid;
+        node->meta.gid = gid;
+        _attributesChanged(*node);
+        if (journal) _journal(JournalOp::Chown, path, {}, false, nullptr, (uint64_t(uid) << 32) | gid);
+    }
+
+    /**
+     * @brief Chooses whether directory sizes count a hard-linked file once or under every link.
+     * @details LinkAccounting::CountOnce by default. Switching recomputes every directory size.
+     */
+    void setLinkAccounting(LinkAccounting mode) {
+        EMFS_OP(SetLinkAccounting, std::string_view());
+        if (mode == linkAccounting) return;
+        linkAccounting = mode;
+        _recomputeSize(*root);
+    }
+
+    LinkAccounting getLinkAccounting() const { return linkAccounting; }
+
+    // --- Access Heat ---
+
+    /**
+     * @brief Starts counting reads (cat, ls, lsDetailed) per node, for heatReport().
+     * @details Counts are sampled: one read in `sampleEvery`, chosen at random, does a relaxed load
+     *          and store on the node, so concurrent readers rarely write the same cache line. Counts
+     *          halve once per `halfLife`, so they favour recent traffic. Decay epochs are counted from
+     *          the first call. Calling this again, also after disableHeatTracking(), keeps the counts
+     *          unless `halfLife` changes; then they are cleared, since their epochs would be misread.
+     */
+    void enableHeatTracking(const HeatOptions& options = {}) {
+        EMFS_OP(EnableHeatTracking, std::string_view());
+        if (options.halfLife.count() <= 0) throw FileSystemException("Heat half-life must be positive.");
+        uint32_t every = 1;
+        while (every < options.sampleEvery && every < (1u << 30)) every <<= 1;
+        if (!heatBase || options.halfLife.count() != heatHalfLife) {
+            if (heatBase) _clearHeat(*root);
+            heatBase = detail::nowNanos();
+            heatHalfLife = options.halfLife.count();
+        }
+        heatSampleEvery.store(every, std::memory_order_relaxed);
+    }
+
+    /// Stops counting reads; counts already taken keep decaying in reports.
+    void disableHeatTracking() {
+        EMFS_OP(DisableHeatTracking, std::string_view());
+        heatSampleEvery.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the `topK` hottest and coldest files and directories below `path`.
+     * @details A directory's heat is that of its whole subtree, its own listings included. Heat is an
+     *          estimate of reads, decayed by the configured half-life; symbolic links are skipped.
+     */
+    HeatReport heatReport(std::string_view path, size_t topK = 10) const {
+        EMFS_OP(HeatReport, path);
+        const FSNode& node = _node(path);
+        if (node.getType() != NodeType::Directory) {
+            throw FileSystemException("Path is not a directory: " + std::string(path));
+        }
+        HeatReport report;
+        if (topK == 0) return report;
+        const std::string prefix = &node == root.get() ? std::string() : _pathOf(node);
+        _collectHeat(static_cast<const DirectoryNode&>(node), prefix, _heatEpoch(detail::nowNanos()), topK,
+                     report.hottest, report.coldest);
+        std::sort_heap(report.hottest.begin(), report.hottest.end(), [](const HeatEntry& a, const HeatEntry& b) {
+            return a.heat != b.heat ? a.heat > b.heat : a.path < b.path;
+        });
+        std::sort_heap(report.coldest.begin(), report.coldest.end(), [](const HeatEntry& a, const HeatEntry& b) {
+            return a.heat != b.heat ? a.heat < b.heat : a.path < b.path;
+        });
+        return report;
+    }
+
+    // --- Expiry ---
+
+    /**
+     * @brief Removes a file or directory (with everything below it) once `ttl` has elapsed.
+     * @details Deadlines are kept in a hierarchical timing wheel, so expiry costs O(1) per node and
+     *          never scans the tree. An expired node vanishes from lookups and listings at once. It is
+     *          unlinked from the tree at the start of the next mutating call, or by expire(), and its
+     *          memory is freed on a background thread. Setting a TTL again replaces the old one. The TTL
+     *          follows the node through mv and is saved in snapshots, but copies do not carry it. Replicas
+     *          see the removal in the journal. Listings, grep, find, search, diff, sync, heatReport and
+     *          snapshots skip expired nodes. Directory sizes and tree hashes still count them until the
+     *          sweep, since const calls cannot unlink under a shared lock.
+     * @param ttl A zero or negative TTL removes the node immediately.
+     */
+    void setTtl(std::string_view path, std::chrono::nanoseconds ttl) {
+        EMFS_OP(SetTtl, path);
+        _expireDue();
+        auto node = _resolvePath(path);
+        if (node == root) throw FileSystemException("Cannot set a TTL on the root directory.");
+        if (ttl.count() <= 0) {
+            _expire(std::move(node));
+            return;
+        }
+        const int64_t now = detail::nowNanos();
+        _scheduleTtl(node, ttl.count() >= INT64_MAX - now ? INT64_MAX : now + ttl.count());
+    }
+
+    /// Cancels a TTL set with setTtl(); the node then stays until removed.
+    void clearTtl(std::string_view path) {
+        EMFS_OP(ClearTtl, path);
+        _expireDue();
+        _resolvePath(path)->expiresAt = 0;
+    }
 
-    // --- Core API ---
-    void mkdir(std::string_view path) {
-        if (path == "/") return;
+    /**
+     * @brief Unlinks every node whose TTL has passed and returns how many were removed.
+     * @details Mutating calls do this on their own; call it to reclaim memory while the tree is idle.
+     */
+    size_t expire() {
+        EMFS_OP(Expire, std::string_view());
+        return _expireDue();
+    }
 
-        std::string path_str(path);
-        std::stringstream ss(path_str);
-        std::string component;
-        auto current = root;
+    // --- Extended Attributes ---
 
-        if (ss.peek() == '/') ss.ignore();
+    /**
+     * @brief Resolves a path once (following symbolic links) and returns a handle to the node.
+     * @details Attribute calls through the handle do no path resolution and keep working after the
+     *          node is renamed.
+     */
+    NodeHandle open(std::string_view path) const {
+        EMFS_OP(Open, path);
+        return NodeHandle(_resolvePath(path));
+    }
 
-        while (std::getline(ss, component, '/')) {
-            if (component.empty()) continue;
-            auto it = current->children.find(component);
-            if (it == current->children.end()) {
-                auto newDir = std::make_shared<DirectoryNode>(component, current);
-                current->children[component] = newDir;
-                current = newDir;
-            } else {
-                if (it->second->getType() != NodeType::Directory) {
-                    throw FileSystemException("A file exists at path component: " + component);
-                }
-                current = std::static_pointer_cast<DirectoryNode>(it->second);
-            }
-        }
+    /// Returns the value of an extended attribute, or nullopt if the node has no attribute of that name.
+    std::optional<std::string> getxattr(std::string_view path, std::string_view name) const {
+        EMFS_OP(GetXattr, path);
+        return _getxattr(*_resolvePath(path), name);
     }
 
-    void touch(std::string_view path) {
-        auto [parent, fileName] = _resolveParentAndName(path);
-        if (parent->children.count(fileName)) {
-            // In unix, touch updates timestamp. Here we just ensure it's a file.
-            if(parent->children.at(fileName)->getType() != NodeType::File) {
-                 throw FileSystemException("Cannot touch '" + std::string(path) + "', a directory with that name exists.");
-            }
-            return; // File already exists, do nothing.
-        }
-        parent->children[fileName] = std::make_shared<FileNode>(fileName, parent);
+    std::optional<std::string> getxattr(const NodeHandle& handle, std::string_view name) const {
+        EMFS_OP(GetXattr, std::string_view());
+        return _getxattr(_handleNode(handle), name);
     }
 
-    void writeFile(std::string_view path, const std::vector<char>& content) {
-        auto [parent, fileName] = _resolveParentAndName(path);
-        if (parent->children.count(fileName) && parent->children.at(fileName)->getType() == NodeType::Directory) {
-            throw FileSystemException("Cannot write to '" + fileName + "', it is a directory.");
-        }
-        auto file = std::make_shared<FileNode>(fileName, parent);
-        file->content = content;
-        parent->children[fileName] = file;
+    /**
+     * @brief Sets an extended attribute on a file, directory or symbolic link target.
+     * @details Attributes belong to the node, so they follow it through mv, are shared by its hard
+     *          links and are duplicated by cp. Names are 1 to 255 bytes and values at most 64 KiB.
+     * @param mode XattrMode::Create fails if the attribute exists, XattrMode::Replace if it does not.
+     */
+    void setxattr(std::string_view path, std::string_view name, std::string_view value,
+                  XattrMode mode = XattrMode::Upsert) {
+        EMFS_OP(SetXattr, path);
+        _expireDue();
+        auto node = _resolvePath(path);
+        _setxattr(*node, name, value, mode);
+        _attributesChanged(*node);
+        if (journal) _journal(JournalOp::SetXattr, path, name, false, _payload(value.data(), value.size()));
     }
-    
-    void writeFile(std::string_view path, std::string_view content) {
-        writeFile(path, std::vector<char>(content.begin(), content.end()));
+
+    void setxattr(const NodeHandle& handle, std::string_view name, std::string_view value,
+                  XattrMode mode = XattrMode::Upsert) {
+        EMFS_OP(SetXattr, std::string_view());
+        _expireDue();
+        FSNode& node = _handleNode(handle);
+        _setxattr(node, name, value, mode);
+        _handleAttributesChanged(node, JournalOp::SetXattr, name, journal ? _payload(value.data(), value.size()) : nullptr);
     }
 
-    void append(std::string_view path, const std::vector<char>& content) {
+    /// Removes an extended attribute; returns false if the node had none of that name.
+    bool removexattr(std::string_view path, std::string_view name) {
+        EMFS_OP(RemoveXattr, path);
+        _expireDue();
         auto node = _resolvePath(path);
-        if (node->getType() != NodeType::File) {
-            throw FileSystemException("Path is not a file: " + std::string(path));
-        }
-        auto file = std::static_pointer_cast<FileNode>(node);
-        file->content.insert(file->content.end(), content.begin(), content.end());
+        if (!_removexattr(*node, name)) return false;
+        _attributesChanged(*node);
+        if (journal) _journal(JournalOp::RemoveXattr, path, name);
+        return true;
     }
 
-    void append(std::string_view path, std::string_view content) {
-        append(path, std::vector<char>(content.begin(), content.end()));
+    bool removexattr(const NodeHandle& handle, std::string_view name) {
+        EMFS_OP(RemoveXattr, std::string_view());
+        _expireDue();
+        FSNode& node = _handleNode(handle);
+        if (!_removexattr(node, name)) return false;
+        _handleAttributesChanged(node, JournalOp::RemoveXattr, name);
+        return true;
     }
 
-    std::vector<char> cat(std::string_view path) const {
-        auto node = _resolvePath(path);
-        if (node->getType() != NodeType::File) {
-            throw FileSystemException("Path is not a file: " + std::string(path));
-        }
-        return std::static_pointer_cast<FileNode>(node)->content;
+    /// Lists the names of a node's extended attributes in sorted order.
+    std::vector<std::string> listxattr(std::string_view path) const {
+        EMFS_OP(ListXattr, path);
+        return _listxattr(*_resolvePath(path));
     }
 
-    std::string catAsString(std::string_view path) const {
-        auto content = cat(path);
-        return std::string(content.begin(), content.end());
+    std::vector<std::string> listxattr(const NodeHandle& handle) const {
+        EMFS_OP(ListXattr, std::string_view());
+        return _listxattr(_handleNode(handle));
     }
 
-    void rm(std::string_view path, bool recursive = false) {
-        if (path == "/") throw FileSystemException("Cannot remove the root directory.");
-        auto [parent, name] = _resolveParentAndName(path);
-        auto it = parent->children.find(name);
-        if (it == parent->children.end()) {
-            throw FileSystemException("Path not found: " + std::string(path));
-        }
-        if (it->second->getType() == NodeType::Directory && !recursive) {
-            if (!std::static_pointer_cast<DirectoryNode>(it->second)->children.empty()) {
-                throw FileSystemException("Directory not empty, use recursive flag: " + std::string(path));
-            }
-        }
-        parent->children.erase(it);
+    /// Chooses when reads (cat, ls) refresh access times; AtimePolicy::Relaxed by default.
+    void setAtimePolicy(AtimePolicy policy) {
+        EMFS_OP(SetAtimePolicy, std::string_view());
+        atimePolicy.store(policy, std::memory_order_relaxed);
     }
 
-    void cp(std::string_view sourcePath, std::string_view destPath) {
-        auto sourceNode = _resolvePath(sourcePath);
-        auto [destParent, newName] = _resolveDestination(destPath, sourceNode->name);
+    AtimePolicy getAtimePolicy() const { return atimePolicy.load(std::memory_order_relaxed); }
 
-        if (destParent->children.count(newName)) {
-            throw FileSystemException("Destination already exists: " + std::string(destPath) + "/" + newName);
-        }
+    // --- Operation Metrics ---
 
-        if (sourceNode->getType() == NodeType::File) {
-            auto oldFile = std::static_pointer_cast<FileNode>(sourceNode);
-            auto newFile = std::make_shared<FileNode>(newName, destParent);
-            newFile->content = oldFile->content;
-            destParent->children[newName] = newFile;
-        } else {
-            auto oldDir = std::static_pointer_cast<DirectoryNode>(sourceNode);
-            auto newDir = std::make_shared<DirectoryNode>(newName, destParent);
-            destParent->children[newName] = newDir;
-            _recursiveCopy(oldDir, newDir);
-        }
+    /**
+     * @brief Returns call counts, failures (calls that threw) and latency histograms per operation.
+     * @details Recording is compiled in only when EMFS_ENABLE_METRICS is defined before this header is
+     *          included. Otherwise EMFS_OP expands to nothing and this returns an empty snapshot with
+     *          `enabled` false. Each thread records into its own shard; this call merges them.
+     */
+    Metrics metrics() const {
+#ifdef EMFS_ENABLE_METRICS
+        return metricsRegistry.snapshot();
+#else
+        return {};
+#endif
     }
 
-    void mv(std::string_view sourcePath, std::string_view destPath) {
-        if (sourcePath == "/") throw FileSystemException("Cannot move the root directory.");
-        auto sourceNode = _resolvePath(sourcePath);
-        auto oldParent = sourceNode->parent.lock();
-        if (!oldParent) throw FileSystemException("Internal error: source node has no parent.");
-        
-        auto [newParent, newName] = _resolveDestination(destPath, sourceNode->name);
-        
-        // Check for moving a directory into itself
-        auto tempParent = newParent;
-        while(tempParent) {
-            if (tempParent.get() == sourceNode.get()) {
-                throw FileSystemException("Cannot move a directory into itself.");
-            }
-            tempParent = tempParent->parent.lock();
-        }
+    // --- Tracing ---
 
-        oldParent->children.erase(sourceNode->name); // Erase by old name before rename
-        sourceNode->parent = newParent;
-        sourceNode->name = newName;
-        newParent->children[newName] = sourceNode;
+    /**
+     * @brief Sends begin/end events for every public operation and its internal phases to `sink`;
+     *        nullptr stops tracing.
+     * @details Tracing is compiled in only when EMFS_ENABLE_TRACING is defined before this header is
+     *          included. Otherwise every hook expands to nothing, the sink is dropped and this returns
+     *          false. Set the sink while no other operation is running.
+     */
+    bool setTraceSink(std::shared_ptr<TraceSink> sink) {
+#ifdef EMFS_ENABLE_TRACING
+        traceSink = std::move(sink);
+        return true;
+#else
+        (void)sink;
+        return false;
+#endif
     }
 
-    std::vector<std::string> ls(std::string_view path) const {
-        auto node = _resolvePath(path);
-        if (node->getType() != NodeType::Directory) {
-            throw FileSystemException("Path is not a directory: " + std::string(path));
+    // --- Allocation Profiling ---
+
+    /**
+     * @brief Returns the heap allocations and bytes made by each operation, in total and at most per call.
+     * @details Needs EMFS_ENABLE_ALLOCATION_PROFILING defined before this header is included, and
+     *          EMFS_DEFINE_ALLOCATION_HOOKS defined as well in exactly one translation unit to replace
+     *          the global operator new with a counting one. A call's count includes nested calls and
+     *          work done for it by other threads is not counted. Otherwise `enabled` is false.
+     */
+    AllocationProfile allocationProfile() const {
+#ifdef EMFS_ENABLE_ALLOCATION_PROFILING
+        return allocationRegistry.snapshot();
+#else
+        return {};
+#endif
+    }
+
+    // --- Consistency Checks ---
+
+    /**
+     * @brief Walks the whole tree and checks its structural invariants, e.g. after a stress run.
+     * @details Every directory and symlink must point back to the directory holding it, under the
+     *          same name. Every file entry must be the file's primary link or one of its extra
+     *          links, and each file's link count must match its entries. Directory sizes must equal
+     *          the bytes below them, and the tree-wide hard-link count must match. Violations are
+     *          reported, not repaired. O(n); a const reader like ls().
+     */
+    VerifyReport verify() const {
+        EMFS_OP(Verify, std::string_view());
+        VerifyReport report;
+        if (root->parent.lock()) report.errors.push_back("/: root has a parent");
+        std::unordered_map<const FileNode*, uint32_t> links;
+        std::unordered_set<const DirectoryNode*> visited;
+        _verify(root, "/", report, links, visited);
+        size_t extraLinks = 0;
+        for (const auto& [file, seen] : links) {
+            ++report.files;
+            extraLinks += file->extraLinks.size();
+            if (file->nlink != seen || file->extraLinks.size() + 1 != seen) {
+                report.errors.push_back(_pathOf(*file) + ": link count is " + std::to_string(file->nlink) + " with " +
+                                        std::to_string(file->extraLinks.size()) + " extra links, but " +
+                                        std::to_string(seen) + " entries refer to it");
+            }
+            if (!file->parent.lock()) report.errors.push_back(file->name + ": linked file has no primary parent");
         }
-        std::vector<std::string> entries;
-        auto dirNode = std::static_pointer_cast<DirectoryNode>(node);
-        for (const auto& [name, child] : dirNode->children) {
-            entries.push_back(name + (child->getType() == NodeType::Directory ? "/" : ""));
+        if (extraLinks != hardLinks) {
+            report.errors.push_back("/: " + std::to_string(hardLinks) + " hard links counted, " +
+                                    std::to_string(extraLinks) + " found");
         }
-        std::sort(entries.begin(), entries.end());
-        return entries;
+        return report;
     }
 
-    bool exists(std::string_view path) const noexcept {
-        try {
-            _resolvePath(path);
-            return true;
-        } catch (...) {
-            return false;
+    // --- Content Search ---
+
+    /**
+     * @brief Searches file contents for a literal string or simple regular expression.
+     * @details File buffers are scanned in place (no `cat` copy) with an SSE2/AVX2 substring search
+     *          selected at runtime, and files are distributed across worker threads.
+     * @param root A file, or a directory whose files are searched.
+     * @param pattern The literal text or GrepMode::Regex pattern to find.
+     * @param options Matching mode, recursion, thread count and per-file match limit.
+     * @return Matches ordered by path, then by offset.
+     */
+    std::vector<GrepMatch> grep(std::string_view root, std::string_view pattern, const GrepOptions& options = {}) const {
+        EMFS_OP(Grep, root);
+        auto node = _resolvePath(root);
+        std::unique_ptr<detail::SimpleRegex> regex;
+        if (options.mode == GrepMode::Regex) regex = std::make_unique<detail::SimpleRegex>(pattern);
+
+        std::vector<std::pair<std::string, std::shared_ptr<FileNode>>> files;
+        std::string rootPath(root);
+        if (rootPath.size() > 1 && rootPath.back() == '/') rootPath.pop_back();
+        _collectFiles(node, rootPath, options.recursive, files);
+        std::sort(files.begin(), files.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::vector<std::vector<GrepMatch>> perFile(files.size());
+        detail::parallelFor(files.size(), options.maxThreads, [&](size_t i) {
+            _grepBuffer(files[i].first, files[i].second->content, pattern, regex.get(),
+                        options.maxMatchesPerFile, perFile[i]);
+        });
+
+        std::vector<GrepMatch> matches;
+        for (auto& fileMatches : perFile) {
+            std::move(fileMatches.begin(), fileMatches.end(), std::back_inserter(matches));
         }
+        return matches;
     }
 
-    NodeType getNodeType(std::string_view path) const {
-        return _resolvePath(path)->getType();
-    }
-    
-    size_t size(std::string_view path) const {
-        return _resolvePath(path)->size();
-    }
-    
     // --- New Features & Aliases ---
 
     /**
@@ -398,6 +5587,13 @@ public:
      */
     std::vector<std::string> dir(std::string_view path) const { return ls(path); }
 
+    /**
+     * @brief [Alias for lsDetailed] Lists directory entries with their stat data.
+     */
+    std::vector<DirEntry> readdirPlus(std::string_view path, const ListOptions& options = {}) const {
+        return lsDetailed(path, options);
+    }
+
     /**
      * @brief [Alias for rm] Removes a file or directory.
      */
@@ -423,6 +5619,7 @@ public:
      * @note This operation interacts with the real file system and is platform-dependent.
      */
     int execute(std::string_view path) {
+        EMFS_OP(Execute, path);
         auto node = _resolvePath(path);
         if (node->getType() != NodeType::File) {
             throw FileSystemException("Path is not a file and cannot be executed: " + std::string(path));
@@ -450,7 +5647,7 @@ public:
         int result = -1;
         try {
             #if defined(__linux__) || defined(__APPLE__) || defined(__MACH__)
-                if (chmod(temp_path.string().c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0) {
+                if (::chmod(temp_path.string().c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0) {
                     throw FileSystemException("Failed to set executable permissions on temporary file.");
                 }
             #endif
@@ -469,4 +5666,497 @@ public:
     }
 };
 
-} // namespace e_mfs
\ No newline at end of file
+#ifdef EMFS_POSIX
+// --- Replication ---
+/**
+ * @struct ReplicationOptions
+ * @brief Batching and compression settings for ReplicationPrimary; `maxFrameBytes` also bounds what
+ *        a ReplicationReplica accepts.
+ */
+struct ReplicationOptions {
+    size_t maxBatchEntries = 256;
+    bool compress = true;
+    std::chrono::milliseconds interval{10}; // Polling interval of the background sender thread
+    size_t maxFrameBytes = size_t(1) << 30; // Largest frame, before or after compression, either side
+                                            // will send or accept; a snapshot must fit in one frame
+};
+
+/**
+ * @struct ReplicaLag
+ * @brief Replication progress of one replica as seen by the primary.
+ */
+struct ReplicaLag {
+    int fd = -1;
+    bool connected = false;       // False after a write error or when the journal outran the replica
+    uint64_t sentSequence = 0;    // Last journal sequence sent
+    uint64_t lagEntries = 0;      // Journal entries not yet sent
+    uint64_t batches = 0;
+    uint64_t rawBytes = 0;        // Bytes before compression
+    uint64_t wireBytes = 0;       // Bytes written to the descriptor
+};
+
+namespace detail {
+
+enum : uint8_t { kFrameSnapshot = 'S', kFrameBatch = 'B' };
+
+inline void writeAll(int fd, const char* data, size_t n) {
+    while (n > 0) {
+        const ssize_t written = ::write(fd, data, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw FileSystemException("Replication write failed: " + std::string(std::strerror(errno)));
+        }
+        data += written;
+        n -= static_cast<size_t>(written);
+    }
+}
+
+/// Reads exactly `n` bytes; returns false on end of stream before the first byte.
+inline bool readAll(int fd, char* data, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        const ssize_t got = ::read(fd, data + done, n - done);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            throw FileSystemException("Replication read failed: " + std::string(std::strerror(errno)));
+        }
+        if (got == 0) {
+            if (done == 0) return false;
+            throw FileSystemException("Replication stream ended mid-frame.");
+        }
+        done += static_cast<size_t>(got);
+    }
+    return true;
+}
+
+/// Frame: kind, compressed flag, raw size, wire size, payload. Returns the bytes written.
+inline size_t writeFrame(int fd, uint8_t kind, const std::string& raw, bool compress, size_t maxBytes) {
+    if (raw.size() > maxBytes) throw FileSystemException("Replication frame exceeds maxFrameBytes.");
+    std::string packed = compress ? lzCompress(raw) : std::string();
+    const bool useCompressed = compress && packed.size() < raw.size();
+    const std::string& payload = useCompressed ? packed : raw;
+    std::string frame;
+    BinaryWriter writer(frame);
+    writer.u8(kind);
+    writer.u8(useCompressed ? 1 : 0);
+    writer.u64(raw.size());
+    writer.u64(payload.size());
+    frame += payload;
+    writeAll(fd, frame.data(), frame.size());
+    return frame.size();
+}
+
+/// Reads one frame; sizes above `maxBytes` are rejected before anything is allocated for them.
+inline bool readFrame(int fd, uint8_t& kind, std::string& raw, size_t& wireBytes, size_t maxBytes) {
+    char header[18];
+    if (!readAll(fd, header, sizeof(header))) return false;
+    BinaryReader reader(std::string_view(header, sizeof(header)));
+    kind = reader.u8();
+    const bool compressed = reader.u8() != 0;
+    const uint64_t rawSize = reader.u64();
+    const uint64_t wireSize = reader.u64();
+    if (rawSize > maxBytes || wireSize > maxBytes || (!compressed && wireSize != rawSize)) {
+        throw FileSystemException("Replication frame size out of bounds.");
+    }
+    std::string payload(wireSize, '\0');
+    if (!payload.empty() && !readAll(fd, payload.data(), payload.size())) {
+        throw FileSystemException("Replication stream ended mid-frame.");
+    }
+    wireBytes = sizeof(header) + payload.size();
+    raw = compressed ? lzDecompress(payload, rawSize) : std::move(payload);
+    return true;
+}
+
+} // namespace detail
+
+/**
+ * @class ReplicationPrimary
+ * @brief Streams a FileSystem's change journal to replicas over pipes or Unix sockets.
+ * @details A new replica first receives a snapshot, then batches of journal entries (compressed with
+ *          detail::lzCompress) starting right after it. pump() and the background sender only read
+ *          the journal, which is thread-safe, so they may run beside the thread that mutates the
+ *          primary. addReplica() reads the tree and must run on that thread. Replicas do not run TTLs
+ *          of their own; the primary journals each expiry as a removal. Ignore SIGPIPE so that
+ *          a vanished replica surfaces as a disconnected ReplicaLag instead of a signal.
+ */
+class ReplicationPrimary {
+public:
+    explicit ReplicationPrimary(FileSystem& fs, ReplicationOptions options = {}) : fs_(fs), options_(options) {
+        fs_.enableJournal();
+    }
+
+    ~ReplicationPrimary() { stop(); }
+
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+
+    /**
+     * @brief Sends a snapshot to `fd` and starts streaming subsequent mutations to it.
+     */
+    void addReplica(int fd) {
+        // Snapshots leave out expired nodes, so their removals must be journaled before the snapshot.
+        fs_.expire();
+        std::ostringstream snapshot;
+        const uint64_t next = fs_.journalNextSequence();
+        fs_.saveSnapshot(snapshot);
+        std::string raw;
+        detail::BinaryWriter(raw).u64(next);
+        raw += snapshot.str();
+        const size_t wire = detail::writeFrame(fd, detail::kFrameSnapshot, raw, options_.compress, options_.maxFrameBytes);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Replica replica;
+        replica.cursor.next = next;
+        replica.lag.fd = fd;
+        replica.lag.connected = true;
+        replica.lag.sentSequence = next - 1;
+        replica.lag.rawBytes = raw.size();
+        replica.lag.wireBytes = wire;
+        replicas_.push_back(std::move(replica));
+    }
+
+    /**
+     * @brief Sends every pending journal entry to every connected replica, in batches.
+     * @return Number of entries sent (summed over replicas).
+     */
+    size_t pump() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t sent = 0;
+        std::vector<JournalEntry> entries;
+        for (auto& replica : replicas_) {
+            while (replica.lag.connected) {
+                entries.clear();
+                try {
+                    if (fs_.readJournal(replica.cursor, entries, options_.maxBatchEntries) == 0) break;
+                    std::string raw;
+                    encodeBatch(entries, raw);
+                    replica.lag.wireBytes += detail::writeFrame(replica.lag.fd, detail::kFrameBatch, raw, options_.compress,
+                                                                 options_.maxFrameBytes);
+                    replica.lag.rawBytes += raw.size();
+                    replica.lag.sentSequence = entries.back().sequence;
+                    ++replica.lag.batches;
+                    sent += entries.size();
+                } catch (const FileSystemException&) {
+                    replica.lag.connected = false; // Write failure, or fell behind retention
+                }
+            }
+        }
+        return sent;
+    }
+
+    /// Starts a background thread that calls pump() every `options.interval`.
+    void start() {
+        if (sender_.joinable()) return;
+        stopping_ = false;
+        sender_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(stopMutex_);
+            while (!stopping_) {
+                lock.unlock();
+                pump();
+                lock.lock();
+                stopSignal_.wait_for(lock, options_.interval, [this] { return stopping_; });
+            }
+        });
+    }
+
+    /// Stops the background sender after a final pump().
+    void stop() {
+        if (!sender_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(stopMutex_);
+            stopping_ = true;
+        }
+        stopSignal_.notify_all();
+        sender_.join();
+        pump();
+    }
+
+    /// Per-replica replication lag and traffic.
+    std::vector<ReplicaLag> lag() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const uint64_t head = fs_.journalNextSequence() - 1;
+        std::vector<ReplicaLag> result;
+        for (const auto& replica : replicas_) {
+            ReplicaLag lag = replica.lag;
+            lag.lagEntries = head - lag.sentSequence;
+            result.push_back(lag);
+        }
+        return result;
+    }
+
+private:
+    struct Replica {
+        JournalCursor cursor;
+        ReplicaLag lag;
+    };
+
+    void encodeBatch(const std::vector<JournalEntry>& entries, std::string& raw) const {
+        detail::BinaryWriter writer(raw);
+        writer.varint(fs_.journalNextSequence() - 1); // Primary head, for the replica's lag metric
+        writer.varint(entries.size());
+        for (const auto& entry : entries) {
+            writer.varint(entry.sequence);
+            writer.u64(static_cast<uint64_t>(entry.timestamp));
+            writer.u8(static_cast<uint8_t>(entry.op));
+            writer.u8(entry.recursive ? 1 : 0);
+            writer.string(entry.path);
+            writer.string(entry.target);
+            writer.varint(entry.argument);
+            if (entry.data) writer.bytes(entry.data->data(), entry.data->size());
+            else writer.varint(0);
+        }
+    }
+
+    FileSystem& fs_;
+    ReplicationOptions options_;
+    mutable std::mutex mutex_;
+    std::vector<Replica> replicas_;
+    std::thread sender_;
+    std::mutex stopMutex_;
+    std::condition_variable stopSignal_;
+    bool stopping_ = false;
+};
+
+/**
+ * @struct ReplicaStatus
+ * @brief Replication progress as seen by a replica.
+ */
+struct ReplicaStatus {
+    uint64_t appliedSequence = 0; // Last primary journal sequence applied
+    uint64_t primarySequence = 0; // Primary head when the last batch was sent
+    uint64_t lagEntries = 0;      // primarySequence - appliedSequence
+    int64_t lagNanos = 0;         // Age of the last applied entry when it was applied
+    uint64_t batches = 0;
+    uint64_t wireBytes = 0;
+    bool snapshotLoaded = false;
+    bool finished = false;        // Stream ended (or failed; see error)
+    std::string error;
+};
+
+/**
+ * @class ReplicationReplica
+ * @brief Applies a ReplicationPrimary stream to a local FileSystem.
+ * @details start() applies the stream on a dedicated thread, so each replica catches up independently
+ *          and concurrently with the primary. Access the replicated tree through read(), which holds
+ *          the same lock the applier takes per batch.
+ */
+class ReplicationReplica {
+public:
+    ReplicationReplica(FileSystem& fs, int fd, ReplicationOptions options = {})
+        : fs_(fs), fd_(fd), options_(options) {}
+
+    ~ReplicationReplica() { join(); }
+
+    ReplicationReplica(const ReplicationReplica&) = delete;
+    ReplicationReplica& operator=(const ReplicationReplica&) = delete;
+
+    /**
+     * @brief Reads and applies one frame.
+     * @return false once the stream has ended.
+     */
+    bool applyNext() {
+        uint8_t kind = 0;
+        std::string raw;
+        size_t wire = 0;
+        if (!detail::readFrame(fd_, kind, raw, wire, options_.maxFrameBytes)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            status_.finished = true;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        status_.wireBytes += wire;
+        detail::BinaryReader reader(raw);
+        if (kind == detail::kFrameSnapshot) {
+            const uint64_t next = reader.u64();
+            std::istringstream snapshot(raw.substr(8));
+            fs_.loadSnapshot(snapshot, false);
+            status_.appliedSequence = status_.primarySequence = next - 1;
+            status_.snapshotLoaded = true;
+        } else if (kind == detail::kFrameBatch) {
+            status_.primarySequence = reader.varint();
+            for (uint64_t count = reader.varint(); count > 0; --count) applyEntry(reader);
+            status_.lagEntries = status_.primarySequence - status_.appliedSequence;
+            ++status_.batches;
+        } else {
+            throw FileSystemException("Unknown replication frame.");
+        }
+        return true;
+    }
+
+    /// Applies the stream on a background thread until it ends.
+    void start() {
+        if (applier_.joinable()) return;
+        applier_ = std::thread([this] {
+            try {
+                while (applyNext()) {}
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                status_.finished = true;
+                status_.error = e.what();
+            }
+        });
+    }
+
+    /// Waits for the background applier to reach the end of the stream.
+    void join() {
+        if (applier_.joinable()) applier_.join();
+    }
+
+    /// Runs `fn(const FileSystem&)` while no batch is being applied.
+    template <typename Fn>
+    auto read(Fn&& fn) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return fn(static_cast<const FileSystem&>(fs_));
+    }
+
+    ReplicaStatus status() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return status_;
+    }
+
+private:
+    void applyEntry(detail::BinaryReader& reader) {
+        const uint64_t sequence = reader.varint();
+        const auto timestamp = static_cast<int64_t>(reader.u64());
+        const auto op = static_cast<JournalOp>(reader.u8());
+        const bool recursive = reader.u8() != 0;
+        const std::string path = reader.string();
+        const std::string target = reader.string();
+        const uint64_t argument = reader.varint();
+        const std::string_view data = reader.bytes();
+        if (sequence <= status_.appliedSequence) return; // Already covered by the snapshot
+        switch (op) {
+            case JournalOp::Mkdir: fs_.mkdir(path); break;
+            case JournalOp::Touch: fs_.touch(path); break;
+            case JournalOp::Write: fs_.writeFile(path, data); break;
+            case JournalOp::Append: fs_.append(path, data); break;
+            case JournalOp::Remove: fs_.rm(path, recursive); break;
+            case JournalOp::Copy: fs_.cp(path, target); break;
+            case JournalOp::Move: fs_.mv(path, target); break;
+            case JournalOp::Link: fs_.link(path, target); break;
+            case JournalOp::Symlink: fs_.symlink(target, path); break;
+            case JournalOp::Retarget: fs_.retarget(path, target); break;
+            case JournalOp::Chmod: fs_.chmod(path, static_cast<uint32_t>(argument)); break;
+            case JournalOp::Chown: fs_.chown(path, static_cast<uint32_t>(argument >> 32), static_cast<uint32_t>(argument)); break;
+            case JournalOp::SetXattr: fs_.setxattr(path, target, data); break;
+            case JournalOp::RemoveXattr: fs_.removexattr(path, target); break;
+            case JournalOp::Patch: fs_.applySyncDelta("/", SyncDelta::decodePatch(data, path)); break;
+            default: throw FileSystemException("Unknown journal operation in replication stream.");
+        }
+        status_.appliedSequence = sequence;
+        status_.lagNanos = detail::nowNanos() - timestamp;
+    }
+
+    FileSystem& fs_;
+    int fd_;
+    ReplicationOptions options_; // Only maxFrameBytes applies to a replica
+    mutable std::mutex mutex_;
+    ReplicaStatus status_;
+    std::thread applier_;
+};
+#endif // EMFS_POSIX
+
+} // namespace e_mfs
+
+// --- Allocation Hooks ---
+// Define EMFS_DEFINE_ALLOCATION_HOOKS, together with EMFS_ENABLE_ALLOCATION_PROFILING, in exactly one
+// translation unit of a profiling build. Its replacement operator new counts every allocation made
+// by the program on the calling thread before forwarding to malloc.
+#if defined(EMFS_ENABLE_ALLOCATION_PROFILING) && defined(EMFS_DEFINE_ALLOCATION_HOOKS)
+#ifdef _MSC_VER
+#include <malloc.h> // For _aligned_malloc
+#endif
+
+namespace e_mfs::detail {
+
+inline const bool allocationHooksRegistered = [] {
+    allocationHooksInstalled.store(true, std::memory_order_relaxed);
+    return true;
+}();
+
+inline void* countedAlloc(std::size_t size, std::size_t alignment) noexcept {
+    countAllocation(size);
+    if (size == 0) size = 1;
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+#ifdef _MSC_VER
+    return _aligned_malloc(size, alignment);
+#else
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+inline void countedFree(void* p, std::size_t alignment) noexcept {
+#ifdef _MSC_VER
+    if (alignment > alignof(std::max_align_t)) return _aligned_free(p);
+#else
+    (void)alignment;
+#endif
+    std::free(p);
+}
+
+inline void* countedNew(std::size_t size, std::size_t alignment) {
+    for (;;) {
+        if (void* p = countedAlloc(size, alignment)) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+} // namespace e_mfs::detail
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EMFS_ALLOCATION_HOOK __attribute__((noinline)) // Keeps GCC from pairing an inlined free() with new
+#else
+#define EMFS_ALLOCATION_HOOK
+#endif
+
+EMFS_ALLOCATION_HOOK void* operator new(std::size_t size) { return e_mfs::detail::countedNew(size, alignof(std::max_align_t)); }
+EMFS_ALLOCATION_HOOK void* operator new[](std::size_t size) { return e_mfs::detail::countedNew(size, alignof(std::max_align_t)); }
+EMFS_ALLOCATION_HOOK void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return e_mfs::detail::countedAlloc(size, alignof(std::max_align_t));
+}
+EMFS_ALLOCATION_HOOK void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return e_mfs::detail::countedAlloc(size, alignof(std::max_align_t));
+}
+EMFS_ALLOCATION_HOOK void* operator new(std::size_t size, std::align_val_t al) {
+    return e_mfs::detail::countedNew(size, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void* operator new[](std::size_t size, std::align_val_t al) {
+    return e_mfs::detail::countedNew(size, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return e_mfs::detail::countedAlloc(size, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return e_mfs::detail::countedAlloc(size, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void operator delete(void* p) noexcept { e_mfs::detail::countedFree(p, alignof(std::max_align_t)); }
+EMFS_ALLOCATION_HOOK void operator delete[](void* p) noexcept { e_mfs::detail::countedFree(p, alignof(std::max_align_t)); }
+EMFS_ALLOCATION_HOOK void operator delete(void* p, std::size_t) noexcept { e_mfs::detail::countedFree(p, alignof(std::max_align_t)); }
+EMFS_ALLOCATION_HOOK void operator delete[](void* p, std::size_t) noexcept { e_mfs::detail::countedFree(p, alignof(std::max_align_t)); }
+EMFS_ALLOCATION_HOOK void operator delete(void* p, const std::nothrow_t&) noexcept {
+    e_mfs::detail::countedFree(p, alignof(std::max_align_t));
+}
+EMFS_ALLOCATION_HOOK void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    e_mfs::detail::countedFree(p, alignof(std::max_align_t));
+}
+EMFS_ALLOCATION_HOOK void operator delete(void* p, std::align_val_t al) noexcept {
+    e_mfs::detail::countedFree(p, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void operator delete[](void* p, std::align_val_t al) noexcept {
+    e_mfs::detail::countedFree(p, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void operator delete(void* p, std::size_t, std::align_val_t al) noexcept {
+    e_mfs::detail::countedFree(p, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void operator delete[](void* p, std::size_t, std::align_val_t al) noexcept {
+    e_mfs::detail::countedFree(p, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept {
+    e_mfs::detail::countedFree(p, static_cast<std::size_t>(al));
+}
+EMFS_ALLOCATION_HOOK void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept {
+    e_mfs::detail::countedFree(p, static_cast<std::size_t>(al));
+}
+#endif // EMFS_DEFINE_ALLOCATION_HOOKS
\ No newline at end of file
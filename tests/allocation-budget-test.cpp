@@ -0,0 +1,60 @@
+/**
+ * @file allocation-budget-test.cpp
+ * @brief Asserts that warmed-up lookups make no heap allocations: exists() on a hit and on a miss,
+ *        and stat().
+ * @details Needs a profiling build with the counting operator new linked in. The test fails rather
+ *          than passes if the hooks are missing, so a build without them cannot hide a regression.
+ *
+ *          Build: g++ -std=c++17 -O2 -DEMFS_ENABLE_ALLOCATION_PROFILING -DEMFS_DEFINE_ALLOCATION_HOOKS -I. tests/allocation-budget-test.cpp -o allocation-budget-test -pthread
+ */
+
+#include "e-mfs.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        std::printf("FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+// Runs `fn` once to warm the thread's lookup buffers, then counts the allocations of the next calls.
+uint64_t allocationsAfterWarmup(const std::function<void()>& fn) {
+    fn();
+    e_mfs::AllocationScope scope;
+    for (int i = 0; i < 100; ++i) fn();
+    return scope.stats().allocations;
+}
+
+} // namespace
+
+int main() {
+    check(e_mfs::AllocationScope::active(), "allocation hooks are installed");
+
+    e_mfs::FileSystem fs;
+    const std::string dir = "/alpha/beta/gamma/delta/epsilon";
+    fs.mkdir(dir);
+    fs.writeFile(dir + "/file.txt", "content");
+    const std::string hit = dir + "/file.txt";
+    const std::string miss = dir + "/missing.txt";
+
+    check(allocationsAfterWarmup([&] { check(fs.exists(hit), "exists finds the file"); }) == 0,
+          "exists() hit allocates nothing");
+    check(allocationsAfterWarmup([&] { check(!fs.exists(miss), "exists misses the file"); }) == 0,
+          "exists() miss allocates nothing");
+    check(allocationsAfterWarmup([&] { check(fs.stat(hit).size == 7, "stat reports the size"); }) == 0,
+          "stat() allocates nothing");
+    check(allocationsAfterWarmup([&] { check(fs.stat(dir).childCount == 1, "stat counts the entries"); }) == 0,
+          "stat() on a directory allocates nothing");
+
+    if (failures) return 1;
+    std::printf("allocation-budget-test: ok\n");
+    return 0;
+}
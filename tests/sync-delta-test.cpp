@@ -0,0 +1,138 @@
+/**
+ * @file sync-delta-test.cpp
+ * @brief Regression tests for malformed SyncDelta input: applySyncDelta and SyncDelta::deserialize
+ *        must reject it with FileSystemException and leave the destination untouched. This covers
+ *        overflowing block ranges, truncated frames and op paths that would escape the subtree.
+ * @details Build with the sanitizers so an out-of-bounds read fails the run even if it does not crash.
+ *
+ *          Build: g++ -std=c++17 -g -fsanitize=address,undefined -I. tests/sync-delta-test.cpp -o sync-delta-test
+ */
+
+#include "e-mfs.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        std::printf("FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+std::string contents(const e_mfs::FileSystem& fs, const std::string& path) {
+    const std::vector<char> data = fs.cat(path);
+    return std::string(data.begin(), data.end());
+}
+
+bool rejects(const std::function<void()>& fn) {
+    try {
+        fn();
+    } catch (const e_mfs::FileSystemException&) {
+        return true;
+    }
+    return false;
+}
+
+e_mfs::SyncDelta patch(uint64_t blockSize, std::vector<e_mfs::SyncDelta::Chunk> chunks) {
+    e_mfs::SyncDelta delta;
+    delta.blockSize = blockSize;
+    delta.ops.push_back({e_mfs::SyncDelta::OpType::PatchFile, "/f", {}, std::move(chunks)});
+    return delta;
+}
+
+void testBlockRanges() {
+    e_mfs::FileSystem fs;
+    fs.writeFile("/f", std::string(64, 'x'));
+    const uint64_t max = UINT64_MAX;
+    // firstBlock + blockCount wraps to a small number in each of these.
+    check(rejects([&] { fs.applySyncDelta("/", patch(16, {{max, 2, {}}})); }), "firstBlock + blockCount wraps");
+    check(rejects([&] { fs.applySyncDelta("/", patch(16, {{1, max, {}}})); }), "blockCount wraps");
+    check(rejects([&] { fs.applySyncDelta("/", patch(16, {{4, 1, {}}})); }), "block past the end");
+    check(rejects([&] { fs.applySyncDelta("/", patch(0, {{0, 1, {}}})); }), "block with a zero block size");
+    // blockCount * blockSize and firstBlock * blockSize would overflow if the ranges were not checked.
+    check(rejects([&] { fs.applySyncDelta("/", patch(uint64_t(1) << 62, {{0, 4, {}}})); }), "block bytes overflow");
+    check(rejects([&] { fs.applySyncDelta("/", patch(16, {{max / 8, 1, {}}})); }), "block offset overflow");
+    check(contents(fs, "/f") == std::string(64, 'x'), "rejected patches leave the file unchanged");
+
+    fs.applySyncDelta("/", patch(16, {{3, 1, {}}, {0, 0, "ab"}, {0, 3, {}}}));
+    check(contents(fs, "/f") == std::string(16, 'x') + "ab" + std::string(48, 'x'), "valid patch applies");
+}
+
+void testFrames() {
+    e_mfs::FileSystem src;
+    src.writeFile("/f", "hello");
+    e_mfs::FileSystem dst;
+    std::stringstream frame;
+    src.makeSyncDelta("/", dst, "/").serialize(frame);
+    const std::string good = frame.str();
+
+    for (size_t cut = 0; cut < good.size(); ++cut) {
+        std::istringstream in(good.substr(0, cut));
+        if (!rejects([&] { e_mfs::SyncDelta::deserialize(in); })) {
+            check(false, "truncated frame");
+            break;
+        }
+    }
+    // A frame claiming an enormous payload must fail as truncated, not allocate it up front.
+    std::string huge = good.substr(0, 8) + std::string(7, '\xFF') + '\x7F';
+    std::istringstream hugeIn(huge);
+    check(rejects([&] { e_mfs::SyncDelta::deserialize(hugeIn); }), "oversized payload length");
+    // Op and chunk counts larger than the payload could hold.
+    for (const std::string& payload : {std::string("\x10\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01", 10),
+                                       std::string("\x10\x01\x04\x02/f\xFF\xFF\xFF\xFF\x0F", 11)}) {
+        std::string bad = good.substr(0, 8);
+        e_mfs::detail::BinaryWriter(bad).u64(payload.size());
+        std::istringstream in(bad + payload);
+        check(rejects([&] { e_mfs::SyncDelta::deserialize(in); }), "count exceeds payload");
+    }
+}
+
+// Op paths must stay inside the destination subtree, whether applied directly or read from a frame.
+void testPaths() {
+    using Type = e_mfs::SyncDelta::OpType;
+    e_mfs::FileSystem fs;
+    fs.mkdir("/sub");
+    fs.writeFile("/sub/x", "x");
+    fs.writeFile("/secret", "s");
+    const std::vector<std::pair<Type, std::string>> bad = {
+        {Type::Remove, "/../secret"}, {Type::WriteFile, "/x/../../escaped"}, {Type::WriteFile, "x"},
+        {Type::WriteFile, ""},         {Type::Remove, "//secret"},           {Type::MakeDir, "/./y"},
+        {Type::MakeDir, "/y/"},        {Type::Remove, "/.."}};
+    for (const auto& [type, path] : bad) {
+        e_mfs::SyncDelta delta;
+        delta.blockSize = 16;
+        delta.ops.push_back({Type::WriteFile, "/first", "applied before the bad op", {}});
+        delta.ops.push_back({type, path, "data", {}});
+        check(rejects([&] { fs.applySyncDelta("/sub", delta); }), "applySyncDelta rejects an escaping path");
+        std::stringstream frame;
+        delta.serialize(frame);
+        check(rejects([&] { e_mfs::SyncDelta::deserialize(frame); }), "deserialize rejects an escaping path");
+    }
+    check(fs.ls("/").size() == 2 && fs.ls("/sub").size() == 1, "rejected deltas change nothing");
+    check(contents(fs, "/secret") == "s", "a file outside the subtree survives");
+
+    e_mfs::SyncDelta delta;
+    delta.ops.push_back({Type::WriteFile, "/y", "y", {}});
+    fs.applySyncDelta("/sub", delta);
+    check(contents(fs, "/sub/y") == "y", "a valid path applies inside the subtree");
+}
+
+} // namespace
+
+int main() {
+    testBlockRanges();
+    testFrames();
+    testPaths();
+    if (failures) return 1;
+    std::printf("sync-delta-test: ok\n");
+    return 0;
+}
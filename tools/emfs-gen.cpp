@@ -0,0 +1,343 @@
+/**
+ * @file emfs-gen.cpp
+ * @brief Generates synthetic workload traces for emfs-replay: a directory tree built to a given
+ *        fan-out and depth, followed by a mix of reads, writes, appends, listings and moves.
+ * @details Files are chosen with Zipfian popularity (rejection-inversion sampling, so 10M+ files
+ *          need no tables beyond a popularity permutation) and sized from a log-normal distribution.
+ *          Arrivals are Poisson at `--rate` operations per second. With `--threads T` each file is
+ *          owned by one of T recorded threads, so a concurrent replay keeps the operations on one
+ *          file in order. The random source is a seeded splitmix64 with hand-written
+ *          distributions, so a given seed produces the same trace everywhere. `--snapshot <file>`
+ *          saves the tree as a snapshot for `emfs-replay --snapshot`, leaving only the mix in the
+ *          trace; use it for concurrent replays. Otherwise the trace starts with the mkdir and
+ *          writeFile calls that build the tree, all on thread 0.
+ *
+ *          Build: g++ -std=c++17 -O2 -I. tools/emfs-gen.cpp -o emfs-gen -pthread
+ */
+
+#include "e-mfs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using e_mfs::Op;
+
+// --- Random Distributions ---
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    double uniform() { return static_cast<double>(next() >> 11) * 0x1.0p-53; } // [0, 1)
+    uint64_t below(uint64_t n) { return static_cast<uint64_t>(uniform() * static_cast<double>(n)); }
+
+    double normal() { // Box-Muller
+        const double u = 1.0 - uniform();
+        return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * 3.14159265358979323846 * uniform());
+    }
+
+    double exponential(double rate) { return -std::log(1.0 - uniform()) / rate; }
+
+private:
+    uint64_t state_;
+};
+
+/**
+ * Samples Zipf(n, s) ranks, returned as 0..n-1, by rejection-inversion (Hörmann and Derflinger, 1996): constant time and
+ * memory per sample for any n.
+ */
+class ZipfSampler {
+public:
+    ZipfSampler(uint64_t n, double exponent)
+        : n_(static_cast<double>(n)), s_(exponent), hx1_(hIntegral(1.5) - 1.0), hn_(hIntegral(n_ + 0.5)),
+          cut_(2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0))) {}
+
+    uint64_t sample(Random& random) const {
+        for (;;) {
+            const double u = hn_ + random.uniform() * (hx1_ - hn_);
+            const double x = hIntegralInverse(u);
+            const double k = std::clamp(std::floor(x + 0.5), 1.0, n_);
+            if (k - x <= cut_ || u >= hIntegral(k + 0.5) - h(k)) return static_cast<uint64_t>(k) - 1;
+        }
+    }
+
+private:
+    // log1p(x)/x and expm1(x)/x, accurate near zero.
+    static double helper1(double x) { return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x)); }
+    static double helper2(double x) { return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x)); }
+
+    double h(double x) const { return std::exp(-s_ * std::log(x)); }
+    double hIntegral(double x) const {
+        const double logX = std::log(x);
+        return helper2((1 - s_) * logX) * logX;
+    }
+    double hIntegralInverse(double x) const {
+        const double t = std::max(x * (1 - s_), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+    double n_;
+    double s_;
+    double hx1_;
+    double hn_;
+    double cut_;
+};
+
+// --- Parameters ---
+struct Options {
+    std::string out;
+    std::string snapshot;
+    std::string root = "/data";
+    uint64_t fanOut = 10;
+    uint64_t depth = 3;
+    uint64_t filesPerDir = 10;
+    uint64_t ops = 100000;
+    double zipf = 0.99;
+    double sizeMu = 7.0;    // Median file size e^7, about 1 KiB
+    double sizeSigma = 1.5;
+    double appendMu = 5.0;  // Median append e^5, about 150 bytes
+    uint64_t maxSize = uint64_t(1) << 20;
+    double rate = 100000;   // Operations per second
+    uint32_t threads = 1;
+    uint64_t seed = 1;
+    e_mfs::RecordContent content = e_mfs::RecordContent::Hash;
+    // Mix weights
+    double read = 60, write = 10, append = 10, ls = 15, mv = 5;
+};
+
+bool parseMix(const std::string& text, Options& o) {
+    o.read = o.write = o.append = o.ls = o.mv = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        const size_t comma = std::min(text.find(',', pos), text.size());
+        const std::string item = text.substr(pos, comma - pos);
+        const size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        const std::string name = item.substr(0, eq);
+        const double weight = std::atof(item.c_str() + eq + 1);
+        if (name == "read") o.read = weight;
+        else if (name == "write") o.write = weight;
+        else if (name == "append") o.append = weight;
+        else if (name == "ls") o.ls = weight;
+        else if (name == "mv") o.mv = weight;
+        else return false;
+        pos = comma + 1;
+    }
+    return o.read + o.write + o.append + o.ls + o.mv > 0;
+}
+
+// --- Generator ---
+class Generator {
+public:
+    explicit Generator(const Options& o) : o_(o), random_(o.seed) {}
+
+    void run() {
+        _buildTree();
+        std::ofstream out(o_.out, std::ios::binary);
+        if (!out) throw e_mfs::FileSystemException("Cannot open " + o_.out);
+        e_mfs::WorkloadWriter writer(out, o_.content);
+        if (o_.snapshot.empty()) {
+            _emitTree(writer);
+        } else {
+            _saveSnapshot();
+        }
+        _emitMix(writer);
+        writer.flush();
+        std::fprintf(stderr, "emfs-gen: %zu directories, %zu files, %llu records\n", dirs_.size(), fileDir_.size(),
+                     static_cast<unsigned long long>(records_));
+    }
+
+private:
+    void _buildTree() {
+        dirs_.push_back(o_.root);
+        for (size_t level = 0, begin = 0; level < o_.depth; ++level) {
+            const size_t end = dirs_.size();
+            for (size_t d = begin; d < end; ++d) {
+                for (uint64_t k = 0; k < o_.fanOut; ++k) dirs_.push_back(_join(dirs_[d], "d", k));
+            }
+            begin = end;
+        }
+        for (size_t d = 0; d < dirs_.size(); ++d) {
+            for (uint64_t k = 0; k < o_.filesPerDir; ++k) {
+                fileDir_.push_back(static_cast<uint32_t>(d));
+                fileName_.push_back(static_cast<uint32_t>(k));
+            }
+        }
+        // Popularity ranks are spread over the tree rather than following creation order.
+        filesByRank_ = _permutation(fileDir_.size());
+        dirsByRank_ = _permutation(dirs_.size());
+    }
+
+    std::vector<uint32_t> _permutation(size_t n) {
+        std::vector<uint32_t> order(n);
+        for (size_t i = 0; i < n; ++i) order[i] = static_cast<uint32_t>(i);
+        for (size_t i = n; i > 1; --i) std::swap(order[i - 1], order[random_.below(i)]);
+        return order;
+    }
+
+    uint64_t _size(double mu) {
+        const double size = std::exp(mu + o_.sizeSigma * random_.normal());
+        return static_cast<uint64_t>(std::min(size, static_cast<double>(o_.maxSize)));
+    }
+
+    static std::string _join(const std::string& dir, const char* prefix, uint64_t n) {
+        return (dir == "/" ? dir : dir + "/") + prefix + std::to_string(n);
+    }
+
+    // Moved files are renamed m<n>, so names never collide with the original f<n>.
+    std::string _filePath(size_t file) const {
+        const uint32_t name = fileName_[file];
+        return _join(dirs_[fileDir_[file]], (name & kMoved) ? "m" : "f", name & ~kMoved);
+    }
+
+    void _write(e_mfs::WorkloadWriter& writer, e_mfs::WorkloadRecord& record) {
+        writer.write(record);
+        ++records_;
+    }
+
+    void _emitTree(e_mfs::WorkloadWriter& writer) {
+        e_mfs::WorkloadRecord record;
+        record.op = Op::Mkdir;
+        for (const std::string& dir : dirs_) {
+            record.path = dir;
+            _write(writer, record);
+        }
+        record.op = Op::WriteFile;
+        for (size_t f = 0; f < fileDir_.size(); ++f) {
+            record.path = _filePath(f);
+            record.bytes = _size(o_.sizeMu);
+            if (o_.content != e_mfs::RecordContent::None) record.contentHash = random_.next();
+            _write(writer, record);
+        }
+    }
+
+    void _saveSnapshot() {
+        e_mfs::FileSystem fs;
+        std::string pool(o_.maxSize + 65536, '\0');
+        for (char& c : pool) c = static_cast<char>('a' + random_.below(26));
+        for (const std::string& dir : dirs_) fs.mkdir(dir);
+        for (size_t f = 0; f < fileDir_.size(); ++f) {
+            fs.writeFile(_filePath(f), std::string_view(pool).substr(random_.below(65536), _size(o_.sizeMu)));
+        }
+        std::ofstream out(o_.snapshot, std::ios::binary);
+        fs.saveSnapshot(out);
+    }
+
+    void _emitMix(e_mfs::WorkloadWriter& writer) {
+        if (fileDir_.empty()) return;
+        const ZipfSampler files(fileDir_.size(), o_.zipf);
+        const ZipfSampler dirs(dirs_.size(), o_.zipf);
+        const double total = o_.read + o_.write + o_.append + o_.ls + o_.mv;
+        uint32_t moved = 0;
+        double clock = 0;
+        e_mfs::WorkloadRecord record;
+        for (uint64_t i = 0; i < o_.ops; ++i) {
+            clock += random_.exponential(o_.rate) * 1e9;
+            record.start = static_cast<int64_t>(clock);
+            record.target.clear();
+            record.bytes = 0;
+            record.contentHash.reset();
+            const size_t file = filesByRank_[files.sample(random_)];
+            record.thread = static_cast<uint32_t>(file % o_.threads);
+            record.path = _filePath(file);
+
+            double pick = random_.uniform() * total;
+            if (pick < o_.read) {
+                record.op = Op::Cat;
+            } else if ((pick -= o_.read) < o_.write + o_.append) {
+                const bool append = pick >= o_.write;
+                record.op = append ? Op::Append : Op::WriteFile;
+                record.bytes = _size(append ? o_.appendMu : o_.sizeMu);
+                if (o_.content != e_mfs::RecordContent::None) record.contentHash = random_.next();
+            } else if (pick - o_.write - o_.append < o_.ls) {
+                record.op = Op::Ls;
+                record.path = dirs_[dirsByRank_[dirs.sample(random_)]];
+            } else {
+                record.op = Op::Mv;
+                fileDir_[file] = static_cast<uint32_t>(random_.below(dirs_.size()));
+                fileName_[file] = kMoved | moved++;
+                record.target = _filePath(file);
+            }
+            _write(writer, record);
+        }
+    }
+
+    static constexpr uint32_t kMoved = uint32_t(1) << 31;
+
+    const Options& o_;
+    Random random_;
+    std::vector<std::string> dirs_;    // Parents before children
+    std::vector<uint32_t> fileDir_;    // Per file: index into dirs_
+    std::vector<uint32_t> fileName_;   // Per file: name number, kMoved set once moved
+    std::vector<uint32_t> filesByRank_;
+    std::vector<uint32_t> dirsByRank_;
+    uint64_t records_ = 0;
+};
+
+void usage() {
+    std::cerr << "usage: emfs-gen --out <trace> [--snapshot <file>] [--root <dir>] [--fanout <n>] [--depth <n>]\n"
+                 "                [--files <per dir>] [--ops <n>] [--mix read=60,write=10,append=10,ls=15,mv=5]\n"
+                 "                [--zipf <s>] [--size-mu <mu>] [--size-sigma <sigma>] [--append-mu <mu>]\n"
+                 "                [--max-size <bytes>] [--rate <ops/s>] [--threads <n>] [--seed <n>]\n"
+                 "                [--content none|hash]\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--out") o.out = value;
+        else if (arg == "--snapshot") o.snapshot = value;
+        else if (arg == "--root") o.root = value;
+        else if (arg == "--fanout") o.fanOut = std::strtoull(value, nullptr, 10);
+        else if (arg == "--depth") o.depth = std::strtoull(value, nullptr, 10);
+        else if (arg == "--files") o.filesPerDir = std::strtoull(value, nullptr, 10);
+        else if (arg == "--ops") o.ops = std::strtoull(value, nullptr, 10);
+        else if (arg == "--zipf") o.zipf = std::atof(value);
+        else if (arg == "--size-mu") o.sizeMu = std::atof(value);
+        else if (arg == "--size-sigma") o.sizeSigma = std::atof(value);
+        else if (arg == "--append-mu") o.appendMu = std::atof(value);
+        else if (arg == "--max-size") o.maxSize = std::strtoull(value, nullptr, 10);
+        else if (arg == "--rate") o.rate = std::atof(value);
+        else if (arg == "--threads") o.threads = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        else if (arg == "--seed") o.seed = std::strtoull(value, nullptr, 10);
+        else if (arg == "--content" && (std::string(value) == "none" || std::string(value) == "hash")) {
+            o.content = std::string(value) == "none" ? e_mfs::RecordContent::None : e_mfs::RecordContent::Hash;
+        } else if (arg == "--mix" && parseMix(value, o)) {
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (o.out.empty() || o.root.empty() || o.root[0] != '/' || o.threads == 0 || o.rate <= 0 || o.zipf < 0) {
+        usage();
+        return 2;
+    }
+    try {
+        Generator(o).run();
+    } catch (const e_mfs::FileSystemException& e) {
+        std::cerr << "emfs-gen: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+/**
+ * @file emfs-replay.cpp
+ * @brief Replays a workload trace recorded with e_mfs::WorkloadRecorder (or written by emfs-gen)
+ *        against a fresh FileSystem and reports throughput and latency.
+ * @details By default operations run one after another on a single thread, as fast as possible.
+ *          `--concurrent` gives every recorded thread its own worker; the FileSystem is then guarded
+ *          by a shared mutex, taken shared for const operations. `--timing` waits for each
+ *          operation's recorded start time, divided by `--speed`. `--snapshot <file>` loads a tree
+ *          saved with saveSnapshot() before replaying. Latencies include any wait for the lock.
+ *          Operations the trace format cannot re-run (those that take more than paths and data)
+ *          are counted as skipped.
+ *
+ *          Build: g++ -std=c++17 -O2 -I. tools/emfs-replay.cpp -o emfs-replay -pthread
+ */
+
+#include "e-mfs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using e_mfs::Op;
+
+struct Step {
+    e_mfs::WorkloadRecord record;
+    std::string_view data; // Content for writeFile and append
+};
+
+enum class Outcome { Ok, Failed, Skipped };
+
+struct Sample {
+    Op op;
+    Outcome outcome;
+    bool recordedFailed;
+    int64_t nanos;
+};
+
+// --- Loading ---
+struct Trace {
+    std::vector<Step> steps;
+    std::string pool; // Filler that unrecorded content is sliced from
+};
+
+// Points each write at its data: the recorded bytes, else a slice of a shared pseudo-random pool
+// that starts at an offset taken from the content hash, so writes that were identical stay
+// identical without every write's data being held in memory.
+constexpr uint64_t kPoolOffsets = 65536;
+
+Trace load(const std::string& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) throw e_mfs::FileSystemException("Cannot open " + file);
+    e_mfs::WorkloadReader reader(in);
+    Trace trace;
+    uint64_t largest = 0;
+    for (Step step; reader.next(step.record);) {
+        const bool writes = step.record.op == Op::WriteFile || step.record.op == Op::Append;
+        if (writes && !step.record.content) largest = std::max(largest, step.record.bytes);
+        trace.steps.push_back(std::move(step));
+        step = Step();
+    }
+    // Traces are in completion order; replay in start order.
+    std::stable_sort(trace.steps.begin(), trace.steps.end(),
+                     [](const Step& a, const Step& b) { return a.record.start < b.record.start; });
+    trace.pool.resize(largest + kPoolOffsets);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (char& c : trace.pool) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        c = static_cast<char>('a' + state % 26);
+    }
+    for (Step& step : trace.steps) {
+        const auto& r = step.record;
+        if (r.op != Op::WriteFile && r.op != Op::Append) continue;
+        step.data = r.content ? std::string_view(*r.content)
+                              : std::string_view(trace.pool).substr(r.contentHash.value_or(0) % kPoolOffsets, r.bytes);
+    }
+    return trace;
+}
+
+// --- Execution ---
+bool isReader(Op op) {
+    switch (op) {
+        case Op::Cat: case Op::Readlink: case Op::Ls: case Op::LsDetailed: case Op::Exists:
+        case Op::GetNodeType: case Op::Size: case Op::Stat: case Op::Lstat:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Runs one step; false if the operation cannot be replayed from a trace.
+bool execute(e_mfs::FileSystem& fs, const Step& step) {
+    const auto& r = step.record;
+    switch (r.op) {
+        case Op::Mkdir: fs.mkdir(r.path); return true;
+        case Op::Touch: fs.touch(r.path); return true;
+        case Op::WriteFile: fs.writeFile(r.path, step.data); return true;
+        case Op::Append: fs.append(r.path, step.data); return true;
+        case Op::Cat: fs.cat(r.path); return true;
+        case Op::Rm: fs.rm(r.path, r.recursive); return true;
+        case Op::Cp: fs.cp(r.path, r.target); return true;
+        case Op::Mv: fs.mv(r.path, r.target); return true;
+        case Op::Link: fs.link(r.path, r.target); return true;
+        case Op::Symlink: fs.symlink(r.target, r.path); return true;
+        case Op::Retarget: fs.retarget(r.path, r.target); return true;
+        case Op::Readlink: fs.readlink(r.path); return true;
+        case Op::Ls: fs.ls(r.path); return true;
+        case Op::LsDetailed: fs.lsDetailed(r.path); return true;
+        case Op::Exists: fs.exists(r.path); return true;
+        case Op::GetNodeType: fs.getNodeType(r.path); return true;
+        case Op::Size: fs.size(r.path); return true;
+        case Op::Stat: fs.stat(r.path); return true;
+        case Op::Lstat: fs.lstat(r.path); return true;
+        case Op::Checksum: fs.checksum(r.path); return true;
+        case Op::TreeHash: fs.treeHash(r.path); return true;
+        default: return false;
+    }
+}
+
+struct Replayer {
+    e_mfs::FileSystem fs;
+    std::shared_mutex lock;
+    bool concurrent = false;
+    bool timing = false;
+    double speed = 1.0;
+    Clock::time_point origin;
+
+    Sample run(const Step& step) {
+        if (timing) {
+            std::this_thread::sleep_until(origin + std::chrono::nanoseconds(
+                static_cast<int64_t>(static_cast<double>(step.record.start) / speed)));
+        }
+        Sample sample{step.record.op, Outcome::Ok, step.record.failed, 0};
+        const auto start = Clock::now();
+        try {
+            bool replayed;
+            if (!concurrent) {
+                replayed = execute(fs, step);
+            } else if (isReader(step.record.op)) {
+                std::shared_lock<std::shared_mutex> guard(lock);
+                replayed = execute(fs, step);
+            } else {
+                std::unique_lock<std::shared_mutex> guard(lock);
+                replayed = execute(fs, step);
+            }
+            if (!replayed) sample.outcome = Outcome::Skipped;
+        } catch (const e_mfs::FileSystemException&) {
+            sample.outcome = Outcome::Failed;
+        }
+        sample.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        return sample;
+    }
+};
+
+// --- Report ---
+struct Summary {
+    uint64_t ops = 0;
+    uint64_t failed = 0;
+    uint64_t mismatched = 0; // Failed on replay but not when recorded, or the reverse
+    std::vector<int64_t> nanos;
+};
+
+double percentile(const std::vector<int64_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    const size_t rank = std::min(sorted.size() - 1, static_cast<size_t>(q * static_cast<double>(sorted.size())));
+    return static_cast<double>(sorted[rank]) / 1000.0;
+}
+
+void report(const std::vector<Sample>& samples, double seconds, bool json) {
+    std::map<std::string, Summary> byOp;
+    Summary all;
+    uint64_t skipped = 0;
+    for (const Sample& s : samples) {
+        if (s.outcome == Outcome::Skipped) {
+            ++skipped;
+            continue;
+        }
+        const bool failed = s.outcome == Outcome::Failed;
+        for (Summary* summary : {&byOp[e_mfs::opName(s.op)], &all}) {
+            ++summary->ops;
+            summary->failed += failed;
+            summary->mismatched += failed != s.recordedFailed;
+            summary->nanos.push_back(s.nanos);
+        }
+    }
+    const double opsPerSec = seconds > 0 ? static_cast<double>(all.ops) / seconds : 0;
+    std::vector<std::pair<std::string, Summary*>> rows;
+    for (auto& [name, s] : byOp) rows.emplace_back(name, &s);
+    rows.emplace_back("all", &all);
+
+    if (json) {
+        std::printf("{\n  \"seconds\": %.6f,\n  \"ops_per_sec\": %.2f,\n  \"skipped\": %llu,\n  \"ops\": [\n", seconds,
+                    opsPerSec, static_cast<unsigned long long>(skipped));
+    } else {
+        std::printf("%.3f s, %.0f ops/s, %llu skipped\n\n", seconds, opsPerSec, static_cast<unsigned long long>(skipped));
+        std::printf("%-14s %10s %8s %10s %10s %10s %10s %10s %10s\n", "op", "count", "failed", "mismatch", "p50 us",
+                    "p90 us", "p99 us", "p99.9 us", "max us");
+    }
+    size_t printed = 0;
+    for (auto& [name, summary] : rows) {
+        Summary& s = *summary;
+        std::sort(s.nanos.begin(), s.nanos.end());
+        const double max = s.nanos.empty() ? 0 : static_cast<double>(s.nanos.back()) / 1000.0;
+        if (json) {
+            std::printf("    {\"op\": \"%s\", \"count\": %llu, \"failed\": %llu, \"mismatched\": %llu, \"p50_us\": %.3f, "
+                        "\"p90_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f}%s\n",
+                        name.c_str(), static_cast<unsigned long long>(s.ops), static_cast<unsigned long long>(s.failed),
+                        static_cast<unsigned long long>(s.mismatched), percentile(s.nanos, 0.5),
+                        percentile(s.nanos, 0.9), percentile(s.nanos, 0.99), percentile(s.nanos, 0.999), max,
+                        ++printed < rows.size() ? "," : "");
+        } else {
+            std::printf("%-14s %10llu %8llu %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name.c_str(),
+                        static_cast<unsigned long long>(s.ops), static_cast<unsigned long long>(s.failed),
+                        static_cast<unsigned long long>(s.mismatched), percentile(s.nanos, 0.5),
+                        percentile(s.nanos, 0.9), percentile(s.nanos, 0.99), percentile(s.nanos, 0.999), max);
+        }
+    }
+    if (json) std::printf("  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string trace;
+    std::string snapshot;
+    bool json = false;
+    auto replayer = std::make_unique<Replayer>();
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--concurrent") {
+            replayer->concurrent = true;
+        } else if (arg == "--timing") {
+            replayer->timing = true;
+        } else if (arg == "--speed" && i + 1 < argc) {
+            replayer->speed = std::atof(argv[++i]);
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else if (arg == "--json") {
+            json = true;
+        } else if (trace.empty() && arg[0] != '-') {
+            trace = arg;
+        } else {
+            trace.clear();
+            break;
+        }
+    }
+    if (trace.empty() || replayer->speed <= 0) {
+        std::cerr << "usage: emfs-replay <trace> [--concurrent] [--timing] [--speed <x>] [--snapshot <file>] [--json]\n";
+        return 2;
+    }
+
+    try {
+        if (!snapshot.empty()) {
+            std::ifstream in(snapshot, std::ios::binary);
+            replayer->fs.loadSnapshot(in);
+        }
+        const Trace loaded = load(trace);
+        const std::vector<Step>& steps = loaded.steps;
+
+        std::vector<Sample> samples;
+        samples.reserve(steps.size());
+        replayer->origin = Clock::now();
+        if (!replayer->concurrent) {
+            for (const Step& step : steps) samples.push_back(replayer->run(step));
+        } else {
+            std::map<uint32_t, std::vector<const Step*>> perThread;
+            for (const Step& step : steps) perThread[step.record.thread].push_back(&step);
+            std::vector<std::vector<Sample>> results(perThread.size());
+            std::vector<std::thread> workers;
+            size_t w = 0;
+            for (auto& [thread, queue] : perThread) {
+                workers.emplace_back([&replayer, &queue = queue, &out = results[w++]] {
+                    out.reserve(queue.size());
+                    for (const Step* step : queue) out.push_back(replayer->run(*step));
+                });
+            }
+            for (auto& worker : workers) worker.join();
+            for (auto& r : results) samples.insert(samples.end(), r.begin(), r.end());
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - replayer->origin).count();
+        report(samples, seconds, json);
+    } catch (const e_mfs::FileSystemException& e) {
+        std::cerr << "emfs-replay: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,381 @@
+/**
+ * @file emfs-stress.cpp
+ * @brief Concurrency stress harness: mixed operations from 1..N threads against one FileSystem,
+ *        under each locking mode, with invariant checks afterwards and a scaling report.
+ * @details FileSystem is externally synchronized, so each locking mode is a wrapper that every
+ *          call goes through: GlobalMutex serializes everything, SharedMutex lets const operations
+ *          share the lock. The hashing calls (checksum(), treeHash() and the diff and sync calls)
+ *          fill caches on nodes, so they must take the lock as writers. A new mode is one more struct with `read` and `write`. For each mode and
+ *          thread count, every thread works for `--seconds` on its own directory (writes, appends,
+ *          renames, mkdir/rm, reads, listings) and also reads a shared directory. Each thread tracks
+ *          what its directory must contain. Afterwards, FileSystem::verify() checks parent pointers,
+ *          link counts and directory sizes, and each directory is compared with its thread's
+ *          expectations, so lost or stray entries are reported. Thread counts double from 1 up to
+ *          `--threads` (the core count by default).
+ *
+ *          Build: g++ -std=c++17 -O2 -I. tools/emfs-stress.cpp -o emfs-stress -pthread
+ */
+
+#include "e-mfs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// --- Locking Modes ---
+struct GlobalMutex {
+    static constexpr const char* kName = "global-mutex";
+    std::mutex mutex;
+
+    template <typename Fn>
+    void read(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        fn();
+    }
+    template <typename Fn>
+    void write(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        fn();
+    }
+};
+
+struct SharedMutex {
+    static constexpr const char* kName = "shared-mutex";
+    std::shared_mutex mutex;
+
+    template <typename Fn>
+    void read(Fn&& fn) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        fn();
+    }
+    template <typename Fn>
+    void write(Fn&& fn) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        fn();
+    }
+};
+
+// --- Workload ---
+struct Options {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    double seconds = 2.0;
+    unsigned files = 64;        // Per thread
+    unsigned writePercent = 30; // Share of mutating operations
+    std::string mode = "all";
+    bool json = false;
+};
+
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15ull + 1) {}
+    uint64_t next() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return state_;
+    }
+    unsigned below(unsigned n) { return static_cast<unsigned>(next() % n); }
+
+private:
+    uint64_t state_;
+};
+
+// One thread's private directory and what it must contain: file name -> size, and subdirectories.
+struct Expected {
+    std::map<std::string, size_t> files;
+    std::map<std::string, bool> dirs;
+};
+
+struct WorkerResult {
+    uint64_t ops = 0;
+    uint64_t errors = 0; // Unexpected exceptions
+    std::vector<uint32_t> nanos;
+    Expected expected;
+};
+
+template <typename Mode>
+class Worker {
+public:
+    Worker(e_mfs::FileSystem& fs, Mode& mode, const Options& o, unsigned id)
+        : fs_(fs), mode_(mode), o_(o), random_(id + 1), dir_("/t" + std::to_string(id)) {}
+
+    void setup() {
+        fs_.mkdir(dir_);
+        for (unsigned f = 0; f < o_.files; ++f) _writeFile("f" + std::to_string(f), 16);
+    }
+
+    WorkerResult run(const std::atomic<bool>& stop) {
+        result_.nanos.reserve(1 << 20);
+        while (!stop.load(std::memory_order_relaxed)) {
+            const auto start = Clock::now();
+            try {
+                _step();
+            } catch (const e_mfs::FileSystemException& e) {
+                if (result_.errors++ == 0) std::fprintf(stderr, "%s: %s\n", dir_.c_str(), e.what());
+            }
+            const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            result_.nanos.push_back(static_cast<uint32_t>(std::min<int64_t>(nanos, UINT32_MAX)));
+            ++result_.ops;
+        }
+        return std::move(result_);
+    }
+
+private:
+    void _step() {
+        if (random_.below(100) < o_.writePercent) {
+            switch (random_.below(5)) {
+                case 0: return _writeFile(_pickFile(), 16 + random_.below(4096));
+                case 1: {
+                    const std::string name = _pickFile();
+                    const size_t n = 1 + random_.below(256);
+                    mode_.write([&] { fs_.append(dir_ + "/" + name, std::string(n, 'a')); });
+                    result_.expected.files[name] += n;
+                    return;
+                }
+                case 2: { // Rename a file to a fresh name
+                    const std::string from = _pickFile();
+                    const std::string to = "r" + std::to_string(renames_++);
+                    mode_.write([&] { fs_.mv(dir_ + "/" + from, dir_ + "/" + to); });
+                    auto& files = result_.expected.files;
+                    files[to] = files[from];
+                    files.erase(from);
+                    return;
+                }
+                case 3: { // A subdirectory with a file, created or removed recursively
+                    const std::string name = "d" + std::to_string(random_.below(8));
+                    auto& dirs = result_.expected.dirs;
+                    if (dirs.count(name)) {
+                        mode_.write([&] { fs_.rm(dir_ + "/" + name, true); });
+                        dirs.erase(name);
+                    } else {
+                        mode_.write([&] {
+                            fs_.mkdir(dir_ + "/" + name);
+                            fs_.writeFile(dir_ + "/" + name + "/x", "payload");
+                        });
+                        dirs[name] = true;
+                    }
+                    return;
+                }
+                default: { // Copy a file over one of a few copy slots
+                    const std::string from = _pickFile();
+                    const std::string to = "c" + std::to_string(random_.below(16));
+                    if (from == to) return;
+                    auto& files = result_.expected.files;
+                    const bool replace = files.count(to) > 0;
+                    mode_.write([&] {
+                        if (replace) fs_.rm(dir_ + "/" + to);
+                        fs_.cp(dir_ + "/" + from, dir_ + "/" + to);
+                    });
+                    files[to] = files[from];
+                    return;
+                }
+            }
+        }
+        switch (random_.below(5)) {
+            case 0: {
+                const std::string name = _pickFile();
+                size_t size = 0;
+                mode_.read([&] { size = fs_.cat(dir_ + "/" + name).size(); });
+                if (size != result_.expected.files[name]) throw e_mfs::FileSystemException("Wrong size read: " + name);
+                return;
+            }
+            case 1: {
+                bool found = false;
+                mode_.read([&] { found = fs_.exists(dir_ + "/" + _pickFile()); });
+                if (!found) throw e_mfs::FileSystemException("Entry missing in " + dir_);
+                return;
+            }
+            case 2: return mode_.read([&] { fs_.stat(dir_ + "/" + _pickFile()); });
+            case 3: return mode_.read([&] { fs_.ls(dir_); });
+            default: return mode_.read([&] { fs_.cat("/shared/s" + std::to_string(random_.below(16))); });
+        }
+    }
+
+    std::string _pickFile() {
+        auto& files = result_.expected.files;
+        auto it = files.begin();
+        std::advance(it, random_.below(static_cast<unsigned>(std::min<size_t>(files.size(), 64))));
+        return it->first;
+    }
+
+    void _writeFile(const std::string& name, size_t n) {
+        mode_.write([&] { fs_.writeFile(dir_ + "/" + name, std::string(n, 'w')); });
+        result_.expected.files[name] = n;
+    }
+
+    e_mfs::FileSystem& fs_;
+    Mode& mode_;
+    const Options& o_;
+    Random random_;
+    const std::string dir_;
+    uint64_t renames_ = 0;
+    WorkerResult result_;
+};
+
+// --- Runs ---
+struct RunResult {
+    std::string mode;
+    unsigned threads = 0;
+    double seconds = 0;
+    uint64_t ops = 0;
+    uint64_t errors = 0;
+    double p50 = 0, p99 = 0, p999 = 0, max = 0; // Microseconds
+    std::vector<std::string> problems;         // Invariant violations and missing or stray entries
+};
+
+// Compares a thread's directory with what the thread expects it to hold.
+void checkDirectory(const e_mfs::FileSystem& fs, const std::string& dir, const Expected& expected,
+                    std::vector<std::string>& problems) {
+    std::map<std::string, bool> seen;
+    for (const auto& entry : fs.lsDetailed(dir)) {
+        const std::string path = dir + "/" + entry.name;
+        if (entry.stat.type == e_mfs::NodeType::Directory) {
+            if (!expected.dirs.count(entry.name)) problems.push_back("stray directory " + path);
+        } else if (auto it = expected.files.find(entry.name); it == expected.files.end()) {
+            problems.push_back("stray file " + path);
+        } else if (entry.stat.size != it->second) {
+            problems.push_back("wrong size " + path);
+        }
+        seen[entry.name] = true;
+    }
+    for (const auto& [name, size] : expected.files) {
+        if (!seen.count(name)) problems.push_back("lost file " + dir + "/" + name);
+    }
+    for (const auto& [name, present] : expected.dirs) {
+        if (!seen.count(name)) problems.push_back("lost directory " + dir + "/" + name);
+    }
+}
+
+double percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * static_cast<double>(sorted.size())))] / 1000.0;
+}
+
+template <typename Mode>
+RunResult run(const Options& o, unsigned threads) {
+    e_mfs::FileSystem fs;
+    Mode mode;
+    fs.mkdir("/shared");
+    for (int s = 0; s < 16; ++s) fs.writeFile("/shared/s" + std::to_string(s), std::string(1024, 's'));
+    std::vector<std::unique_ptr<Worker<Mode>>> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.push_back(std::make_unique<Worker<Mode>>(fs, mode, o, t));
+        workers.back()->setup();
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<WorkerResult> results(threads);
+    std::vector<std::thread> pool;
+    const auto start = Clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] { results[t] = workers[t]->run(stop); });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(o.seconds));
+    stop = true;
+    for (auto& thread : pool) thread.join();
+
+    RunResult r;
+    r.mode = Mode::kName;
+    r.threads = threads;
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::vector<uint32_t> nanos;
+    for (unsigned t = 0; t < threads; ++t) {
+        r.ops += results[t].ops;
+        r.errors += results[t].errors;
+        nanos.insert(nanos.end(), results[t].nanos.begin(), results[t].nanos.end());
+        checkDirectory(fs, "/t" + std::to_string(t), results[t].expected, r.problems);
+    }
+    const e_mfs::VerifyReport report = fs.verify();
+    r.problems.insert(r.problems.end(), report.errors.begin(), report.errors.end());
+    std::sort(nanos.begin(), nanos.end());
+    r.p50 = percentile(nanos, 0.5);
+    r.p99 = percentile(nanos, 0.99);
+    r.p999 = percentile(nanos, 0.999);
+    r.max = nanos.empty() ? 0 : nanos.back() / 1000.0;
+    return r;
+}
+
+void print(const RunResult& r, bool json, bool last) {
+    if (json) {
+        std::printf("    {\"mode\": \"%s\", \"threads\": %u, \"ops_per_sec\": %.2f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                    "\"p999_us\": %.3f, \"max_us\": %.3f, \"errors\": %llu, \"invariant_violations\": %zu}%s\n",
+                    r.mode.c_str(), r.threads, static_cast<double>(r.ops) / r.seconds, r.p50, r.p99, r.p999, r.max,
+                    static_cast<unsigned long long>(r.errors), r.problems.size(), last ? "" : ",");
+    } else {
+        std::printf("%-14s %7u %14.0f %10.2f %10.2f %10.2f %10.2f %8llu  %s\n", r.mode.c_str(), r.threads,
+                    static_cast<double>(r.ops) / r.seconds, r.p50, r.p99, r.p999, r.max,
+                    static_cast<unsigned long long>(r.errors), r.problems.empty() ? "ok" : "FAILED");
+    }
+    for (size_t i = 0; i < r.problems.size() && i < 10; ++i) std::fprintf(stderr, "  %s\n", r.problems[i].c_str());
+    std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            o.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            o.seconds = std::atof(argv[++i]);
+        } else if (arg == "--files" && i + 1 < argc) {
+            o.files = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--write-percent" && i + 1 < argc) {
+            o.writePercent = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--mode" && i + 1 < argc) {
+            o.mode = argv[++i];
+        } else if (arg == "--json") {
+            o.json = true;
+        } else {
+            o.threads = 0;
+            break;
+        }
+    }
+    if (o.threads == 0 || o.files == 0 || o.writePercent > 100 ||
+        (o.mode != "all" && o.mode != GlobalMutex::kName && o.mode != SharedMutex::kName)) {
+        std::cerr << "usage: emfs-stress [--threads <max>] [--seconds <per run>] [--files <per thread>]\n"
+                     "                   [--write-percent <0-100>] [--mode all|global-mutex|shared-mutex] [--json]\n";
+        return 2;
+    }
+
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < o.threads; t *= 2) counts.push_back(t);
+    counts.push_back(o.threads);
+
+    std::vector<RunResult> results;
+    if (o.json) {
+        std::printf("{\n  \"benchmark\": \"emfs-stress\",\n  \"seconds_per_run\": %.2f,\n  \"runs\": [\n", o.seconds);
+    } else {
+        std::printf("%-14s %7s %14s %10s %10s %10s %10s %8s  %s\n", "mode", "threads", "ops/s", "p50 us", "p99 us",
+                    "p99.9 us", "max us", "errors", "invariants");
+    }
+    const size_t runs = counts.size() * (o.mode == "all" ? 2 : 1);
+    bool failed = false;
+    auto record = [&](RunResult r) {
+        failed |= r.errors > 0 || !r.problems.empty();
+        results.push_back(std::move(r));
+        print(results.back(), o.json, results.size() == runs);
+    };
+    for (unsigned t : counts) {
+        if (o.mode == "all" || o.mode == GlobalMutex::kName) record(run<GlobalMutex>(o, t));
+    }
+    for (unsigned t : counts) {
+        if (o.mode == "all" || o.mode == SharedMutex::kName) record(run<SharedMutex>(o, t));
+    }
+    if (o.json) std::printf("  ]\n}\n");
+    return failed ? 1 : 0;
+}